@@ -0,0 +1,230 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+//
+// Benchmark for how much a write allocates when a snapshot is always being
+// held, like a widget holding the last frame it was given while the next
+// one is drawn.  The data is a 4K image, and it is written with one, two
+// and three buffers (see SnapshottableBase::setSnapshotBuffers()) under
+// each snapshot policy.
+//
+// Then the same goes for a million ints, with one changed per write, kept
+// in a QVector (which gets copied whole) and in a PersistentVector (which
+// only copies a path through its tree).
+//
+// usage: bufferbench [writes] [items]
+//
+
+#include <string.h>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QTextStream>
+
+#include "thinkerqt/snapshottable.h"
+#include "thinkerqt/persistentcontainers.h"
+
+
+static qint64 allocatedBytes = 0;
+
+
+class FrameData : public SnapshottableData
+{
+public:
+    FrameData ()
+        : image (3840, 2160, QImage::Format_RGB32)
+    {
+        image.fill(0);
+    }
+
+    // The image is shared, not copied, until the copy is written to
+    //
+    FrameData (const FrameData& other)
+        : SnapshottableData (other),
+        image (other.image)
+    {
+        allocatedBytes += sizeof(FrameData);
+    }
+
+    virtual bool copyFrom(const SnapshottableData& other) override {
+        const FrameData& data = static_cast<const FrameData&>(other);
+
+        if (image.size() != data.image.size()) {
+            image = data.image.copy();
+            allocatedBytes += imageBytes(image);
+            return true;
+        }
+
+        memcpy(image.bits(), data.image.constBits(), imageBytes(image));
+        return true;
+    }
+
+    static size_t imageBytes(const QImage& image)
+      { return static_cast<size_t>(image.bytesPerLine()) * image.height(); }
+
+    QImage image;
+};
+
+
+class Frame : public Snapshottable<FrameData>
+{
+public:
+    Frame (SnapshotPolicy policy, int buffers)
+    {
+        setSnapshotPolicy(policy, HERE);
+        setSnapshotBuffers(buffers, HERE);
+    }
+
+    void write(qint64 index) {
+        lockForWrite(HERE);
+
+        FrameData& data = writable(HERE);
+
+        // bits() makes the image its own copy if it was shared
+        //
+        const uchar* before = data.image.constBits();
+        uchar* bits = data.image.bits();
+        if (bits != before)
+            allocatedBytes += FrameData::imageBytes(data.image);
+
+        size_t bytes = FrameData::imageBytes(data.image);
+        bits[(static_cast<size_t>(index) * 4) % bytes] = uchar(index);
+
+        unlock(HERE);
+    }
+};
+
+
+template <class Container>
+class ItemsData : public SnapshottableData
+{
+public:
+    ItemsData ()
+    { }
+
+    ItemsData (const ItemsData& other)
+        : SnapshottableData (other),
+        items (other.items)
+    { }
+
+    Container items;
+};
+
+
+static void setItem(QVector<int>& items, int index, int value)
+{
+    items[index] = value;
+}
+
+static void setItem(PersistentVector<int>& items, int index, int value)
+{
+    items.set(index, value);
+}
+
+
+template <class Container>
+class Items : public Snapshottable<ItemsData<Container>>
+{
+public:
+    Items (int count)
+    {
+        this->lockForWrite(HERE);
+        Container& items = this->writable(HERE).items;
+        for (int index = 0; index < count; ++index)
+            items.append(index);
+        this->unlock(HERE);
+    }
+
+    void write(qint64 index) {
+        this->lockForWrite(HERE);
+        Container& items = this->writable(HERE).items;
+        setItem(items, static_cast<int>(index % items.size()), int(index));
+        this->unlock(HERE);
+    }
+};
+
+
+template <class Container>
+static double msPerItemWrite(qint64 writes, int count)
+{
+    Items<Container> items (count);
+    typename Items<Container>::Snapshot held = items.createSnapshot();
+
+    QElapsedTimer timer;
+    timer.start();
+    for (qint64 index = 0; index < writes; ++index) {
+        items.write(index);
+        held = items.createSnapshot();
+    }
+    return timer.nsecsElapsed() / double(writes) / 1000000.0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app (argc, argv);
+    QStringList args = app.arguments();
+
+    qint64 writes = args.size() > 1 ? args[1].toInt() : 200;
+    int count = args.size() > 2 ? args[2].toInt() : 1000000;
+
+    QTextStream out (stdout);
+
+    for (int locked = 1; locked >= 0; --locked) {
+        SnapshottableBase::SnapshotPolicy policy = locked
+            ? SnapshottableBase::LockedSnapshots
+            : SnapshottableBase::PublishedSnapshots;
+
+        out << (locked ? "LockedSnapshots" : "PublishedSnapshots") << endl;
+
+        for (int buffers = 1; buffers <= 3; ++buffers) {
+            Frame frame (policy, buffers);
+            Frame::Snapshot held = frame.createSnapshot();
+
+            allocatedBytes = 0;
+
+            QElapsedTimer timer;
+            timer.start();
+            for (qint64 index = 0; index < writes; ++index) {
+                frame.write(index);
+                held = frame.createSnapshot();
+            }
+            qint64 elapsed = timer.nsecsElapsed();
+
+            out << "  " << buffers
+                << (buffers == 1 ? " buffer:  " : " buffers: ")
+                << (allocatedBytes / writes) << " bytes allocated per write, "
+                << (elapsed / double(writes) / 1000000.0) << " ms per write"
+                << endl;
+        }
+    }
+
+    out << count << " items" << endl;
+    out << "  QVector:          "
+        << msPerItemWrite<QVector<int>>(writes, count) << " ms per write"
+        << endl;
+    out << "  PersistentVector: "
+        << msPerItemWrite<PersistentVector<int>>(writes, count)
+        << " ms per write" << endl;
+
+    return 0;
+}
@@ -0,0 +1,170 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+//
+// Microbenchmark for the per-call overhead of the library's own checking.
+// It times a few of the calls that programs make most often.  Build it in
+// both debug and release to see what THINKERQT_CHECKED costs.
+//
+// usage: checkbench [iterations]
+//
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include "thinkerqt/thinker.h"
+
+
+class CountThinkerData : public SnapshottableData
+{
+public:
+    CountThinkerData ()
+        : count (0), nanoseconds (0)
+    { }
+
+    CountThinkerData (const CountThinkerData& other)
+        : SnapshottableData (other),
+        count (other.count),
+        nanoseconds (other.nanoseconds)
+    { }
+
+    qint64 count;
+    qint64 nanoseconds;
+};
+
+
+//
+// Measures wasPauseRequested() from inside the thinker, then finishes
+//
+class PollThinker : public Thinker<CountThinkerData>
+{
+public:
+    PollThinker (qint64 iterations)
+        : iterations (iterations)
+    { }
+
+protected:
+    virtual bool start() override {
+        QElapsedTimer timer;
+        timer.start();
+
+        qint64 requests = 0;
+        for (qint64 index = 0; index < iterations; ++index) {
+            if (wasPauseRequested())
+                ++requests;
+        }
+
+        qint64 elapsed = timer.nsecsElapsed();
+
+        lockForWrite();
+        writable().count = requests;
+        writable().nanoseconds = elapsed;
+        unlock();
+        return true;
+    }
+
+private:
+    qint64 iterations;
+};
+
+
+//
+// Spins until paused; start() gets called again each time it is resumed
+//
+class SpinThinker : public Thinker<CountThinkerData>
+{
+protected:
+    virtual bool start() override {
+        while (not wasPauseRequested())
+            continue;
+        return false;
+    }
+};
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app (argc, argv);
+    QStringList args = app.arguments();
+
+    qint64 iterations = args.size() > 1 ? args[1].toInt() : 10000000;
+
+    QTextStream out (stdout);
+
+  #if THINKERQT_CHECKED
+    out << "THINKERQT_CHECKED is on" << endl;
+  #else
+    out << "THINKERQT_CHECKED is off" << endl;
+  #endif
+
+    // Polling for a pause request, on the thinker's thread
+    {
+        PollThinker::Present present = ThinkerQt::run<PollThinker>(iterations);
+        present.waitForFinished();
+
+        PollThinker::Snapshot snapshot = present.createSnapshot();
+        out << "  wasPauseRequested(): "
+            << (snapshot.data().nanoseconds / double(iterations))
+            << " ns per call" << endl;
+    }
+
+    // Taking a snapshot of a finished thinker, on the manager thread
+    {
+        PollThinker::Present present = ThinkerQt::run<PollThinker>(1);
+        present.waitForFinished();
+
+        qint64 const snapshots = iterations / 10;
+        qint64 total = 0;
+
+        QElapsedTimer timer;
+        timer.start();
+        for (qint64 index = 0; index < snapshots; ++index)
+            total += present.createSnapshot().data().count;
+        qint64 elapsed = timer.nsecsElapsed();
+
+        out << "  createSnapshot(): "
+            << (elapsed / double(snapshots)) << " ns per call"
+            << " (" << total << ")" << endl;
+    }
+
+    // Round trips of pausing and resuming a running thinker
+    {
+        SpinThinker::Present present = ThinkerQt::run<SpinThinker>();
+
+        qint64 const roundTrips = iterations / 1000;
+
+        QElapsedTimer timer;
+        timer.start();
+        for (qint64 index = 0; index < roundTrips; ++index) {
+            present.pause();
+            present.resumeMaybeEmitDone();
+        }
+        qint64 elapsed = timer.nsecsElapsed();
+
+        out << "  pause() and resume: "
+            << (elapsed / double(roundTrips)) << " ns per round trip" << endl;
+
+        present.cancel();
+    }
+
+    return 0;
+}
@@ -0,0 +1,205 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+//
+// Checks that thinkers on fibers give their pool threads back while they
+// are paused, and pick up where they left off when resumed (on whichever
+// thread is free).  The .pro file builds the library with
+// THINKERQT_USE_FIBERS.
+//
+// It fills every pool thread with a spinning thinker and pauses them all.
+// Then it runs as many more thinkers again, which can only get a thread if
+// the paused ones let go of theirs.  Last, it resumes the spinners and lets
+// them finish, counting how many came back on a different thread than the
+// one they paused on.  It exits with 1 if anything didn't happen in time.
+//
+// usage: fibercheck [timeoutMs]
+//
+
+#include <atomic>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QThread>
+
+#include "thinkerqt/thinker.h"
+
+
+static std::atomic<int> spinnersStarted (0);
+static std::atomic<bool> spinnersMayFinish (false);
+
+
+class SpinThinkerData : public SnapshottableData
+{
+public:
+    SpinThinkerData ()
+        : threadChanges (0)
+    { }
+
+    SpinThinkerData (const SpinThinkerData& other)
+        : SnapshottableData (other),
+        threadChanges (other.threadChanges)
+    { }
+
+    int threadChanges;
+};
+
+
+//
+// On a fiber a pause suspends inside wasPauseRequested(), so this loop
+// never sees it.  It only notices that it's on another thread afterward.
+//
+class SpinThinker : public Thinker<SpinThinkerData>
+{
+protected:
+    virtual bool start() override {
+        ++spinnersStarted;
+
+        int threadChanges = 0;
+        QThread * thread = QThread::currentThread();
+
+        while (not spinnersMayFinish.load()) {
+            if (wasPauseRequested(1))
+                return false;
+
+            if (QThread::currentThread() != thread) {
+                thread = QThread::currentThread();
+                ++threadChanges;
+            }
+        }
+
+        lockForWrite();
+        writable().threadChanges = threadChanges;
+        unlock();
+        return true;
+    }
+};
+
+
+class QuickThinker : public Thinker<SpinThinkerData>
+{
+protected:
+    virtual bool start() override {
+        return true;
+    }
+};
+
+
+template <class PresentType>
+static bool waitUntilFinished(
+    std::vector<PresentType> & presents,
+    int timeoutMs
+){
+    QElapsedTimer timer;
+    timer.start();
+    for (PresentType & present : presents) {
+        while (not present.isFinished()) {
+            if (timer.elapsed() > timeoutMs)
+                return false;
+            QThread::msleep(1);
+        }
+    }
+    return true;
+}
+
+
+// So a failed check doesn't leave thinkers running as the program exits
+//
+template <class PresentType>
+static void cancelAll(std::vector<PresentType> & presents)
+{
+    for (PresentType & present : presents)
+        present.cancel();
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app (argc, argv);
+    QStringList args = app.arguments();
+
+    int timeoutMs = args.size() > 1 ? args[1].toInt() : 10000;
+
+    QTextStream out (stdout);
+
+    ThinkerManager & mgr = ThinkerManager::getGlobalManager();
+    mgr.setFiberStackSize(256 * 1024);
+
+    int threads = mgr.maxThreadCount();
+
+    std::vector<SpinThinker::Present> spinners;
+    for (int index = 0; index < threads; ++index)
+        spinners.push_back(ThinkerQt::run<SpinThinker>());
+
+    QElapsedTimer timer;
+    timer.start();
+    while (spinnersStarted.load() < threads) {
+        if (timer.elapsed() > timeoutMs) {
+            out << "FAILED: spinners didn't all start" << endl;
+            cancelAll(spinners);
+            return 1;
+        }
+        QThread::msleep(1);
+    }
+
+    for (SpinThinker::Present & spinner : spinners)
+        spinner.pause();
+
+    out << threads << " spinners paused" << endl;
+
+    // Without fibers, these would wait for a thread forever
+    //
+    std::vector<QuickThinker::Present> quick;
+    for (int index = 0; index < threads; ++index)
+        quick.push_back(ThinkerQt::run<QuickThinker>());
+
+    if (not waitUntilFinished(quick, timeoutMs)) {
+        out << "FAILED: paused spinners held on to their threads" << endl;
+        cancelAll(quick);
+        cancelAll(spinners);
+        return 1;
+    }
+
+    out << threads << " more thinkers ran while they were paused" << endl;
+
+    for (SpinThinker::Present & spinner : spinners)
+        spinner.resumeMaybeEmitDone();
+
+    spinnersMayFinish = true;
+
+    if (not waitUntilFinished(spinners, timeoutMs)) {
+        out << "FAILED: resumed spinners didn't finish" << endl;
+        cancelAll(spinners);
+        return 1;
+    }
+
+    int moved = 0;
+    for (SpinThinker::Present & spinner : spinners)
+        if (spinner.createSnapshot().data().threadChanges != 0)
+            ++moved;
+
+    out << threads << " spinners resumed and finished, "
+        << moved << " of them on a different thread" << endl;
+
+    return 0;
+}
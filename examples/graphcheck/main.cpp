@@ -0,0 +1,353 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+//
+// Checks ThinkerGraph on diamond-shaped graphs: a top node feeds two nodes
+// in the middle, and those both feed a bottom one.  The .pro file builds
+// with THINKERQT_CHECKED, so the thread checks are on.  The middle and
+// bottom thinkers are constructed on pool threads, and the nodes' Presents
+// are asked for and dropped here.  A check that fails stops the program.
+//
+// Many graphs are run at once and their bottom nodes' results checked.
+// Then graphs with a long chain and a short branch are run one at a time on
+// a single pool thread, and the order their nodes started in is checked:
+// no node may start before its inputs, and the long chain (the critical
+// path) must get ahead of the short branch.  Last, graphs are run whose top
+// node never finishes by itself, and they are canceled, which must keep
+// everything below the top from running.
+//
+// usage: graphcheck [graphs]
+//
+
+#include <memory>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTextStream>
+
+#include "thinkerqt/thinker.h"
+#include "thinkerqt/thinkergraph.h"
+
+
+class ValueThinkerData : public SnapshottableData
+{
+public:
+    ValueThinkerData ()
+        : value (0)
+    { }
+
+    ValueThinkerData (const ValueThinkerData& other)
+        : SnapshottableData (other),
+        value (other.value)
+    { }
+
+    qint64 value;
+};
+
+
+//
+// The nodes of a graph in the order their thinkers started
+//
+struct StartLog {
+    QMutex mutex;
+    QList<int> nodes;
+};
+
+
+//
+// Puts its value in the data after doing some work, or waits to be canceled
+// if it is told to
+//
+class ValueThinker : public Thinker<ValueThinkerData>
+{
+public:
+    ValueThinker (
+        qint64 value,
+        bool untilCanceled = false,
+        shared_ptr<StartLog> log = nullptr,
+        int node = -1
+    ) :
+        value (value),
+        untilCanceled (untilCanceled),
+        log (log),
+        node (node)
+    { }
+
+protected:
+    virtual bool start() override {
+        if (log) {
+            QMutexLocker lock (&log->mutex);
+            log->nodes.append(node);
+        }
+
+        for (int steps = 0; steps < 10000; ++steps) {
+            if (wasPauseRequested())
+                return false;
+        }
+
+        // Nothing to do but wait, so don't spin
+        //
+        while (untilCanceled) {
+            if (wasPauseRequested(100))
+                return false;
+        }
+
+        lockForWrite();
+        writable().value = value;
+        unlock();
+        return true;
+    }
+
+private:
+    qint64 value;
+    bool untilCanceled;
+    shared_ptr<StartLog> log;
+    int node;
+};
+
+
+typedef std::function<unique_ptr<ValueThinker>(ThinkerGraphInputs const &)>
+    Factory;
+
+
+struct Diamond {
+    unique_ptr<ThinkerGraph> graph;
+    ThinkerGraphNode<ValueThinker> bottom;
+};
+
+
+static Diamond makeDiamond(qint64 seed, bool untilCanceled)
+{
+    Diamond diamond;
+    diamond.graph.reset(new ThinkerGraph ());
+    ThinkerGraph & graph = *diamond.graph;
+
+    ThinkerGraphNode<ValueThinker> top = graph.add<ValueThinker>(
+        Factory ([seed, untilCanceled](ThinkerGraphInputs const &) {
+            return unique_ptr<ValueThinker> (
+                new ValueThinker (seed, untilCanceled)
+            );
+        })
+    );
+
+    ThinkerGraphNode<ValueThinker> plusOne = graph.add<ValueThinker>(
+        Factory ([top](ThinkerGraphInputs const & in) {
+            qint64 above = in.snapshot(top).data().value;
+            return unique_ptr<ValueThinker> (new ValueThinker (above + 1));
+        }),
+        {top}
+    );
+
+    ThinkerGraphNode<ValueThinker> timesTwo = graph.add<ValueThinker>(
+        Factory ([top](ThinkerGraphInputs const & in) {
+            qint64 above = in.snapshot(top).data().value;
+            return unique_ptr<ValueThinker> (new ValueThinker (above * 2));
+        }),
+        {top}
+    );
+
+    diamond.bottom = graph.add<ValueThinker>(
+        Factory ([plusOne, timesTwo](ThinkerGraphInputs const & in) {
+            qint64 sum = in.snapshot(plusOne).data().value
+                + in.snapshot(timesTwo).data().value;
+            return unique_ptr<ValueThinker> (new ValueThinker (sum));
+        }),
+        {plusOne, timesTwo}
+    );
+
+    return diamond;
+}
+
+
+//
+// A root with a chain of three nodes under it, and one node on its own.
+// The lone node is added first, so if priorities were ignored it would be
+// queued first.
+//
+enum ChainNode { Root, Short, Long1, Long2, Long3 };
+
+struct Chain {
+    unique_ptr<ThinkerGraph> graph;
+    shared_ptr<StartLog> log;
+    ThinkerGraphNode<ValueThinker> shortNode;
+    ThinkerGraphNode<ValueThinker> longNode;
+};
+
+
+static Chain makeChain(qint64 seed)
+{
+    Chain chain;
+    chain.graph.reset(new ThinkerGraph ());
+    chain.log = make_shared<StartLog>();
+    ThinkerGraph & graph = *chain.graph;
+    shared_ptr<StartLog> log = chain.log;
+
+    ThinkerGraphNode<ValueThinker> root = graph.add<ValueThinker>(
+        Factory ([seed, log](ThinkerGraphInputs const &) {
+            return unique_ptr<ValueThinker> (
+                new ValueThinker (seed, false, log, Root)
+            );
+        })
+    );
+
+    chain.shortNode = graph.add<ValueThinker>(
+        Factory ([root, log](ThinkerGraphInputs const & in) {
+            qint64 above = in.snapshot(root).data().value;
+            return unique_ptr<ValueThinker> (
+                new ValueThinker (above * 2, false, log, Short)
+            );
+        }),
+        {root}
+    );
+
+    ThinkerGraphNode<ValueThinker> above = root;
+    for (int node = Long1; node <= Long3; ++node) {
+        ThinkerGraphNode<ValueThinker> input = above;
+        above = graph.add<ValueThinker>(
+            Factory ([input, log, node](ThinkerGraphInputs const & in) {
+                qint64 value = in.snapshot(input).data().value;
+                return unique_ptr<ValueThinker> (
+                    new ValueThinker (value + 1, false, log, node)
+                );
+            }),
+            {input}
+        );
+    }
+    chain.longNode = above;
+
+    return chain;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app (argc, argv);
+    QStringList args = app.arguments();
+
+    int graphCount = args.size() > 1 ? args[1].toInt() : 100;
+
+    QTextStream out (stdout);
+
+    std::vector<Diamond> diamonds;
+    for (int index = 0; index < graphCount; ++index) {
+        diamonds.push_back(makeDiamond(index, false));
+        diamonds.back().graph->start();
+    }
+
+    for (int index = 0; index < graphCount; ++index) {
+        Diamond & diamond = diamonds[index];
+        diamond.graph->waitForFinished();
+
+        ValueThinker::Present bottom = diamond.graph->present(diamond.bottom);
+        if (bottom == ValueThinker::Present ()) {
+            out << "FAILED: graph " << index << " never ran its bottom node"
+                << endl;
+            return 1;
+        }
+
+        qint64 expected = (index + 1) + (index * 2);
+        qint64 actual = bottom.createSnapshot().data().value;
+        if (actual != expected) {
+            out << "FAILED: graph " << index << " came out to " << actual
+                << " instead of " << expected << endl;
+            return 1;
+        }
+    }
+
+    out << graphCount << " diamonds ran with the checks on" << endl;
+
+    // With only one pool thread, whatever the pool picks from its queue is
+    // what runs next, so the start order shows the priorities
+    //
+    ThinkerManager & mgr = ThinkerManager::getGlobalManager();
+    int maxThreadCount = mgr.maxThreadCount();
+    mgr.setMaxThreadCount(1);
+
+    for (int index = 0; index < graphCount; ++index) {
+        Chain chain = makeChain(index);
+        chain.graph->start();
+        chain.graph->waitForFinished();
+
+        QList<int> order;
+        {
+            QMutexLocker lock (&chain.log->mutex);
+            order = chain.log->nodes;
+        }
+
+        bool inputsFirst = (order.size() == 5)
+            and (order.indexOf(Root) == 0)
+            and (order.indexOf(Long1) < order.indexOf(Long2))
+            and (order.indexOf(Long2) < order.indexOf(Long3));
+        if (not inputsFirst) {
+            out << "FAILED: chain " << index << " started "
+                << order.size() << " nodes, or one before its input" << endl;
+            return 1;
+        }
+
+        if (order.indexOf(Short) < order.indexOf(Long2)) {
+            out << "FAILED: chain " << index << " started its short branch "
+                << "ahead of the critical path" << endl;
+            return 1;
+        }
+
+        qint64 longValue = chain.graph->present(chain.longNode)
+            .createSnapshot().data().value;
+        qint64 shortValue = chain.graph->present(chain.shortNode)
+            .createSnapshot().data().value;
+        if (longValue != index + 3 or shortValue != index * 2) {
+            out << "FAILED: chain " << index << " came out to " << longValue
+                << " and " << shortValue << endl;
+            return 1;
+        }
+    }
+
+    mgr.setMaxThreadCount(maxThreadCount);
+
+    out << graphCount << " chains started their critical path first" << endl;
+
+    diamonds.clear();
+    for (int index = 0; index < graphCount; ++index) {
+        diamonds.push_back(makeDiamond(index, true));
+        diamonds.back().graph->start();
+    }
+
+    for (Diamond & diamond : diamonds)
+        diamond.graph->cancel();
+
+    for (int index = 0; index < graphCount; ++index) {
+        Diamond & diamond = diamonds[index];
+        diamond.graph->waitForFinished();
+
+        ValueThinker::Present bottom = diamond.graph->present(diamond.bottom);
+        if (bottom != ValueThinker::Present ()) {
+            out << "FAILED: canceled graph " << index
+                << " ran its bottom node anyway" << endl;
+            return 1;
+        }
+    }
+
+    out << graphCount << " diamonds were canceled before their top finished"
+        << endl;
+
+    return 0;
+}
@@ -12,17 +12,36 @@ SOURCES       = main.cpp \
 SOURCES     += $$THINKER_SRC/signalthrottler.cpp  \
                $$THINKER_SRC/snapshottable.cpp \
                $$THINKER_SRC/thinker.cpp \
+               $$THINKER_SRC/thinkercache.cpp \
+               $$THINKER_SRC/thinkerexecutor.cpp \
+               $$THINKER_SRC/thinkerfiber.cpp \
+               $$THINKER_SRC/thinkergraph.cpp \
+               $$THINKER_SRC/thinkergroup.cpp \
+               $$THINKER_SRC/thinkerinterest.cpp \
                $$THINKER_SRC/thinkermanager.cpp \
                $$THINKER_SRC/thinkerpresent.cpp \
                $$THINKER_SRC/thinkerpresentwatcher.cpp \
-               $$THINKER_SRC/thinkerrunner.cpp
+               $$THINKER_SRC/thinkerrunner.cpp \
+               $$THINKER_SRC/thinkerslot.cpp \
+               $$THINKER_SRC/workstealingexecutor.cpp
 
 HEADERS     += $$THINKER_INC/signalthrottler.h \
                $$THINKER_INC/thinker.h \
+               $$THINKER_INC/thinkercache.h \
                $$THINKER_INC/thinkermanager.h \
                $$THINKER_INC/thinkerpresentwatcher.h \
                $$THINKER_INC/thinkerrunner.h \
-               $$THINKER_INC/thinkerbase.h
+               $$THINKER_INC/thinkerslot.h \
+               $$THINKER_INC/thinkerbase.h \
+               $$THINKER_INC/thinkerexecutor.h \
+               $$THINKER_INC/chaselevdeque.h \
+               $$THINKER_INC/workstealingexecutor.h \
+               $$THINKER_INC/thinkerfiber.h \
+               $$THINKER_INC/thinkerinterest.h \
+               $$THINKER_INC/thinkergroup.h \
+               $$THINKER_INC/thinkergraph.h \
+               $$THINKER_INC/thinkerresults.h \
+               $$THINKER_INC/persistentcontainers.h
 
 INCLUDEPATH += ../../include
 QMAKE_CXXFLAGS += -std=c++0x
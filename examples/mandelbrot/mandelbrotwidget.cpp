@@ -52,13 +52,14 @@ MandelbrotWidget::MandelbrotWidget(QWidget *parent)
     centerX = DefaultCenterX;
     centerY = DefaultCenterY;
     pixmapScale = DefaultScale;
+    pixmapVersion = 0;
     curScale = DefaultScale;
 
     for (int i = 0; i < ColormapSize; ++i)
         colormap[i] = rgbFromWaveLength(380.0 + (i * 400.0 / ColormapSize));
 
-    connect(&watcher, SIGNAL(written()), this, SLOT(updatePixmap()));
-    watcher.setThrottleTime(400);
+    connect(&thinkerSlot, SIGNAL(written()), this, SLOT(updatePixmap()));
+    thinkerSlot.setThrottleTime(400);
 
     setWindowTitle(tr("Mandelbrot"));
 #ifndef QT_NO_CURSOR
@@ -69,21 +70,19 @@ MandelbrotWidget::MandelbrotWidget(QWidget *parent)
 
 MandelbrotWidget::~MandelbrotWidget()
 {
-    watcher.cancel();
+    thinkerSlot.cancel();
 }
 
 void MandelbrotWidget::resetThinker(double centerX, double centerY,
                 double scaleFactor, QSize resultSize)
 {
-    Q_UNUSED(centerX)
-    Q_UNUSED(centerY)
-    Q_UNUSED(scaleFactor)
-    Q_UNUSED(resultSize)
-
-    watcher.cancel();
-
-    watcher.setPresent(ThinkerQt::run<RenderThinker>(centerX, centerY,
-        scaleFactor, resultSize, colormap));
+    // The slot cancels the previous render, and if several of these come in
+    // a row (as they do while zooming with the wheel) only the last is run
+    //
+    thinkerSlot.run([=]() {
+        return unique_ptr<RenderThinker>(new RenderThinker(centerX, centerY,
+            scaleFactor, resultSize, colormap));
+    });
 }
 
 void MandelbrotWidget::paintEvent(QPaintEvent * /* event */)
@@ -199,9 +198,23 @@ void MandelbrotWidget::updatePixmap()
     if (!lastDragPos.isNull())
         return;
 
-    RenderThinker::Snapshot snap = watcher.createSnapshot();
+    RenderThinker::Snapshot snap = thinkerSlot.createSnapshot();
     if (snap->hasImage()) {
-        pixmap = QPixmap::fromImage(snap->getImage());
+        // If the pixmap shows an earlier pass of the same render, only the
+        // strips that changed since then need to be uploaded
+        //
+        const QImage& image = snap->getImage();
+        QVector<QRect> changed;
+        if (!pixmap.isNull() && pixmap.size() == image.size()
+            && snap.changedSince(pixmapVersion, changed)) {
+            QPainter painter(&pixmap);
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            for (const QRect& strip : changed)
+                painter.drawImage(strip.topLeft(), image, strip);
+        } else {
+            pixmap = QPixmap::fromImage(image);
+        }
+        pixmapVersion = snap.version();
         pixmapScale = snap->getScaleFactor();
         snap.clear();
         pixmapOffset = QPoint();
@@ -38,6 +38,7 @@
 #include <QPixmap>
 #include <QWidget>
 #include "thinkerqt/thinker.h"
+#include "thinkerqt/thinkerslot.h"
 
 #include "renderthread.h"
 
@@ -66,11 +67,12 @@ private:
     void scroll(int deltaX, int deltaY);
     uint rgbFromWaveLength(double wave);
 
-    RenderThinker::PresentWatcher watcher;
+    ThinkerSlot<RenderThinker> thinkerSlot;
     void resetThinker(double centerX, double centerY, double scaleFactor,
                 QSize resultSize);
 
     QPixmap pixmap;
+    quint64 pixmapVersion; /* of the snapshot the pixmap was made from */
     QPoint pixmapOffset;
     QPoint lastDragPos;
     double centerX;
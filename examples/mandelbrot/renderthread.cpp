@@ -35,9 +35,64 @@
 #include <QtGui>
 
 #include <math.h>
+#include <string.h>
+#include <atomic>
 
 #include "renderthread.h"
 
+bool RenderThinkerData::copyFrom(const SnapshottableData& other)
+{
+    const RenderThinkerData& data
+        = static_cast<const RenderThinkerData&>(other);
+
+    setImage(data.image);
+    scaleFactor = data.scaleFactor;
+    return true;
+}
+
+void RenderThinkerData::setImage(
+    const QImage& newImage, QVector<QRect>* changed
+) {
+    // Copy the pixels into the image we have if it's the same shape.  (It
+    // is never shared, so bits() won't detach.)  Otherwise make our own
+    // copy, rather than sharing newImage and paying for it on the next
+    // write.
+    //
+    if (image.size() != newImage.size()
+        || image.format() != newImage.format()) {
+        image = newImage.copy();
+        if (changed)
+            changed->append(image.rect());
+        return;
+    }
+
+    // Later passes only change pixels that earlier ones left black, which
+    // are on few of the rows.  So copy just the rows that differ, and
+    // collect them into strips.
+    //
+    uchar *bits = image.bits();
+    const uchar *newBits = newImage.constBits();
+    size_t rowBytes = static_cast<size_t>(image.bytesPerLine());
+
+    int stripTop = -1;
+    for (int y = 0; y <= image.height(); ++y) {
+        bool differs = (y < image.height())
+            && memcmp(bits + y * rowBytes, newBits + y * rowBytes, rowBytes);
+
+        if (differs) {
+            memcpy(bits + y * rowBytes, newBits + y * rowBytes, rowBytes);
+            if (stripTop == -1)
+                stripTop = y;
+        } else if (stripTop != -1) {
+            if (changed) {
+                changed->append(
+                    QRect(0, stripTop, image.width(), y - stripTop));
+            }
+            stripTop = -1;
+        }
+    }
+}
+
 RenderThinker::RenderThinker(
     double centerX, double centerY, double scaleFactor,
     QSize resultSize, const Colormap& colormap
@@ -48,6 +103,10 @@ RenderThinker::RenderThinker(
     resultSize (resultSize),
     colormap (colormap)
 {
+    // The widget holds a snapshot while it paints, so each pass would
+    // otherwise copy the whole image to write the next one
+    //
+    setSnapshotBuffers(3, HERE);
 }
 
 bool RenderThinker::start()
@@ -61,51 +120,73 @@ bool RenderThinker::start()
     while (pass < NumPasses) {
         const int MaxIterations = (1 << (2 * pass + 6)) + 32;
         const int Limit = 4;
-        bool allBlack = true;
-
-        for (int y = -halfHeight; y < halfHeight; ++y) {
-           if (wasPauseRequested())
-                return true;
-
-            uint *scanLine =
-                reinterpret_cast<uint *>(image.scanLine(y + halfHeight));
-
-            double ay = centerY + (y * scaleFactor);
-
-            for (int x = -halfWidth; x < halfWidth; ++x) {
-                double ax = centerX + (x * scaleFactor);
-                double a1 = ax;
-                double b1 = ay;
-                int numIterations = 0;
-
-                do {
-                    ++numIterations;
-                    double a2 = (a1 * a1) - (b1 * b1) + ax;
-                    double b2 = (2 * a1 * b1) + ay;
-                    if ((a2 * a2) + (b2 * b2) > Limit)
-                        break;
-
-                    ++numIterations;
-                    a1 = (a2 * a2) - (b2 * b2) + ax;
-                    b1 = (2 * a2 * b2) + ay;
-                    if ((a1 * a1) + (b1 * b1) > Limit)
-                        break;
-                } while (numIterations < MaxIterations);
-
-                if (numIterations < MaxIterations) {
-                    *scanLine++ = colormap[numIterations % ColormapSize];
-                    allBlack = false;
-                } else {
-                    *scanLine++ = qRgb(0, 0, 0);
+        std::atomic<bool> allBlack (true);
+
+        // The rows are spread over the pool in bands.  The image is never
+        // shared (passes are copied out of it), so this doesn't detach.
+        //
+        uchar *bits = image.bits();
+        int bytesPerLine = image.bytesPerLine();
+
+        bool completed = parallelFor(-halfHeight, halfHeight, 8,
+            [&](int bandBegin, int bandEnd) {
+                for (int y = bandBegin; y < bandEnd; ++y) {
+                   if (wasPauseRequested())
+                        return;
+
+                    uint *scanLine = reinterpret_cast<uint *>(
+                        bits + (y + halfHeight) * bytesPerLine
+                    );
+
+                    double ay = centerY + (y * scaleFactor);
+
+                    for (int x = -halfWidth; x < halfWidth; ++x) {
+                        double ax = centerX + (x * scaleFactor);
+                        double a1 = ax;
+                        double b1 = ay;
+                        int numIterations = 0;
+
+                        do {
+                            ++numIterations;
+                            double a2 = (a1 * a1) - (b1 * b1) + ax;
+                            double b2 = (2 * a1 * b1) + ay;
+                            if ((a2 * a2) + (b2 * b2) > Limit)
+                                break;
+
+                            ++numIterations;
+                            a1 = (a2 * a2) - (b2 * b2) + ax;
+                            b1 = (2 * a2 * b2) + ay;
+                            if ((a1 * a1) + (b1 * b1) > Limit)
+                                break;
+                        } while (numIterations < MaxIterations);
+
+                        if (numIterations < MaxIterations) {
+                            *scanLine++ =
+                                colormap[numIterations % ColormapSize];
+                            allBlack.store(false, std::memory_order_relaxed);
+                        } else {
+                            *scanLine++ = qRgb(0, 0, 0);
+                        }
+                    }
                 }
             }
-        }
+        );
+
+        if (!completed)
+            return true;
 
         if (allBlack && pass == 0) {
             pass = 4;
         } else {
+            // Marking even nothing says no other rows changed, so the
+            // widget can update just the strips that did
+            //
+            QVector<QRect> changed;
             lockForWrite();
-            writable().image = image;
+            writable().setImage(image, &changed);
+            markDirty(QRect());
+            for (const QRect& strip : changed)
+                markDirty(strip);
             writable().scaleFactor = scaleFactor;
             unlock();
             ++pass;
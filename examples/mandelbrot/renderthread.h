@@ -40,6 +40,8 @@
 #include <QThread>
 #include <QWaitCondition>
 #include <QImage>
+#include <QRect>
+#include <QVector>
 #include "thinkerqt/thinker.h"
 
 class RenderThinker;
@@ -60,6 +62,16 @@ public:
         scaleFactor(other.scaleFactor)
     { }
 
+    // Lets the thinker's spare buffers be reused without reallocating the
+    // image (see RenderThinker's constructor)
+    //
+    virtual bool copyFrom(const SnapshottableData& other) override;
+
+    // If changed isn't null, the strips of rows that actually differed are
+    // added to it
+    //
+    void setImage(const QImage& newImage, QVector<QRect>* changed = 0);
+
     bool hasImage() const { return !image.isNull(); }
 
     QImage const & getImage() const { return image; }
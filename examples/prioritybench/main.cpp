@@ -0,0 +1,201 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+//
+// Benchmark for how long an interactive thinker waits to start when the
+// pool is saturated.  Each pool thread gets a backlog of background
+// thinkers that each do some milliseconds of work.  Then "probe" thinkers
+// are run every couple of milliseconds, and the time from run() to their
+// start() is recorded.  The probes are run once at the same priority as the
+// background (so they queue behind it) and once at HighPriority.
+//
+// usage: prioritybench [backlogPerThread] [workMs] [probes]
+//
+
+#include <algorithm>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QTextStream>
+#include <QTimer>
+
+#include "thinkerqt/thinker.h"
+
+
+// One clock for every thread, so times taken on different ones compare
+//
+static QElapsedTimer benchClock;
+
+
+class BusyThinkerData : public SnapshottableData
+{
+public:
+    BusyThinkerData ()
+    { }
+
+    BusyThinkerData (const BusyThinkerData& other)
+        : SnapshottableData (other)
+    { }
+};
+
+
+//
+// Spins for a while (polling, as a well-behaved thinker does) and finishes
+//
+class BusyThinker : public Thinker<BusyThinkerData>
+{
+public:
+    BusyThinker (int workMs)
+        : workMs (workMs)
+    { }
+
+protected:
+    virtual bool start() override {
+        QElapsedTimer timer;
+        timer.start();
+        while (timer.elapsed() < workMs) {
+            if (wasPauseRequested())
+                return false;
+        }
+        return true;
+    }
+
+private:
+    int workMs;
+};
+
+
+class ProbeThinkerData : public SnapshottableData
+{
+public:
+    ProbeThinkerData ()
+        : waitedNs (0)
+    { }
+
+    ProbeThinkerData (const ProbeThinkerData& other)
+        : SnapshottableData (other),
+        waitedNs (other.waitedNs)
+    { }
+
+    qint64 waitedNs;
+};
+
+
+//
+// Records how long it was between being run and being started
+//
+class ProbeThinker : public Thinker<ProbeThinkerData>
+{
+public:
+    ProbeThinker ()
+        : queuedNs (benchClock.nsecsElapsed())
+    { }
+
+protected:
+    virtual bool start() override {
+        qint64 startedNs = benchClock.nsecsElapsed();
+
+        lockForWrite();
+        writable().waitedNs = startedNs - queuedNs;
+        unlock();
+        return true;
+    }
+
+private:
+    qint64 queuedNs;
+};
+
+
+static double percentileMs(std::vector<qint64> const & sorted, double p)
+{
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[index] / 1000000.0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app (argc, argv);
+    QStringList args = app.arguments();
+
+    int backlogPerThread = args.size() > 1 ? args[1].toInt() : 20;
+    int workMs = args.size() > 2 ? args[2].toInt() : 10;
+    int probeCount = args.size() > 3 ? args[3].toInt() : 100;
+
+    QTextStream out (stdout);
+
+    ThinkerManager & mgr = ThinkerManager::getGlobalManager();
+    int threads = mgr.maxThreadCount();
+
+    out << threads << " pool threads, "
+        << backlogPerThread * threads << " background thinkers of "
+        << workMs << " ms, " << probeCount << " probes" << endl;
+
+    benchClock.start();
+
+    for (int high = 0; high <= 1; ++high) {
+        std::vector<BusyThinker::Present> background;
+        for (int index = 0; index < backlogPerThread * threads; ++index) {
+            background.push_back(mgr.run(
+                unique_ptr<BusyThinker> (new BusyThinker (workMs)),
+                ThinkerManager::NormalPriority
+            ));
+        }
+
+        std::vector<ProbeThinker::Present> probes;
+        for (int index = 0; index < probeCount; ++index) {
+            probes.push_back(mgr.run(
+                unique_ptr<ProbeThinker> (new ProbeThinker ()),
+                high
+                    ? ThinkerManager::HighPriority
+                    : ThinkerManager::NormalPriority
+            ));
+
+            // Wait in the event loop rather than sleeping, the way a GUI
+            // thread would between user actions
+            //
+            QEventLoop pause;
+            QTimer::singleShot(2, &pause, [&pause]() { pause.quit(); });
+            pause.exec();
+        }
+
+        std::vector<qint64> waits;
+        for (ProbeThinker::Present & probe : probes) {
+            probe.waitForFinished();
+            waits.push_back(probe.createSnapshot().data().waitedNs);
+        }
+        std::sort(waits.begin(), waits.end());
+
+        out << (high ? "  HighPriority:   " : "  NormalPriority: ")
+            << "p50 " << percentileMs(waits, 0.50) << " ms, "
+            << "p99 " << percentileMs(waits, 0.99) << " ms, "
+            << "max " << (waits.back() / 1000000.0) << " ms" << endl;
+
+        // The backlog isn't part of the next measurement
+        //
+        for (BusyThinker::Present & present : background)
+            present.cancel();
+    }
+
+    return 0;
+}
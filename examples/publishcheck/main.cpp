@@ -0,0 +1,255 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+//
+// Checks SnapshottableBase::PublishedSnapshots with readers that never let
+// up, and times it against LockedSnapshots.  A thinker writes a new
+// generation of its data over and over while some other threads take
+// snapshots of it in a loop.
+//
+// Every data object poisons itself when it is destroyed.  So if a version
+// were let go of while a reader still had it pinned (or was holding a
+// snapshot of it), the reader would find the poison, or a generation that
+// doesn't match its own contents.  Readers also check that the generations
+// they see never go backwards.  It exits with 1 if anything was off.
+//
+// usage: publishcheck [generations] [readers]
+//
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include "thinkerqt/thinker.h"
+
+
+static std::atomic<qint64> versionsFreed (0);
+
+
+class GenerationThinkerData : public SnapshottableData
+{
+public:
+    enum {
+        Alive = 0x600D,
+        Freed = 0xDEAD,
+        Size = 64
+    };
+
+    GenerationThinkerData ()
+        : alive (Alive), generation (0)
+    {
+        for (int index = 0; index < Size; ++index)
+            values[index] = 0;
+    }
+
+    GenerationThinkerData (const GenerationThinkerData& other)
+        : SnapshottableData (other),
+        alive (Alive),
+        generation (other.generation)
+    {
+        for (int index = 0; index < Size; ++index)
+            values[index] = other.values[index];
+    }
+
+    // The poison is written through volatile, or the compiler could drop it
+    // as stores to an object that is going away
+    //
+    ~GenerationThinkerData ()
+    {
+        *static_cast<int volatile *>(&alive) = Freed;
+        *static_cast<qint64 volatile *>(&generation) = -1;
+        for (int index = 0; index < Size; ++index)
+            static_cast<qint64 volatile *>(values)[index] = -1;
+        ++versionsFreed;
+    }
+
+    // True unless it was freed (or torn) while someone could see it
+    //
+    bool isIntact () const
+    {
+        if (alive != Alive)
+            return false;
+        for (int index = 0; index < Size; ++index)
+            if (values[index] != generation)
+                return false;
+        return true;
+    }
+
+    int alive;
+    qint64 generation;
+    qint64 values[Size];
+};
+
+
+//
+// Writes each generation under its own lockForWrite(), which is the worst
+// case for publishing: every unlock() makes a version, and the next write
+// has to copy it
+//
+class GenerationThinker : public Thinker<GenerationThinkerData>
+{
+public:
+    GenerationThinker (qint64 generations, SnapshotPolicy policy)
+        : generations (generations)
+    {
+        setSnapshotPolicy(policy, HERE);
+    }
+
+protected:
+    virtual bool start() override {
+        for (qint64 generation = 1; generation <= generations; ++generation) {
+            if (wasPauseRequested())
+                return false;
+
+            lockForWrite();
+            GenerationThinkerData & data = writable();
+            data.generation = generation;
+            for (int index = 0; index < GenerationThinkerData::Size; ++index)
+                data.values[index] = generation;
+            unlock();
+        }
+        return true;
+    }
+
+private:
+    qint64 generations;
+};
+
+
+struct ReaderResult {
+    qint64 snapshots;
+    qint64 broken;
+    qint64 backwards;
+};
+
+
+//
+// Keeps taking snapshots until the thinker is finished.  Each one is held a
+// little while and checked again before it is let go of.
+//
+static void readUntilFinished(
+    GenerationThinker::Present const & present,
+    ReaderResult & result
+){
+    result = ReaderResult {0, 0, 0};
+
+    qint64 lastGeneration = 0;
+    bool finished = false;
+    while (not finished) {
+        finished = present.isFinished();
+
+        GenerationThinker::Snapshot snapshot = present.createSnapshot();
+        GenerationThinkerData const & data = snapshot.data();
+        ++result.snapshots;
+
+        if (not data.isIntact())
+            ++result.broken;
+        else if (data.generation < lastGeneration)
+            ++result.backwards;
+        else
+            lastGeneration = data.generation;
+
+        std::this_thread::yield();
+
+        if (not data.isIntact())
+            ++result.broken;
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app (argc, argv);
+    QStringList args = app.arguments();
+
+    qint64 generations = args.size() > 1 ? args[1].toInt() : 200000;
+    int readerCount = args.size() > 2 ? args[2].toInt() : 2;
+
+    QTextStream out (stdout);
+
+    out << generations << " generations, " << readerCount << " readers"
+        << endl;
+
+    bool failed = false;
+
+    for (int published = 0; published <= 1; ++published) {
+        qint64 freedBefore = versionsFreed.load();
+
+        QElapsedTimer timer;
+        timer.start();
+
+        GenerationThinker::Present present
+            = ThinkerQt::run<GenerationThinker>(
+                generations,
+                published
+                    ? SnapshottableBase::PublishedSnapshots
+                    : SnapshottableBase::LockedSnapshots
+            );
+
+        // The Present stays on this thread; the readers only borrow it
+        //
+        std::vector<ReaderResult> results (readerCount);
+        std::vector<std::thread> readers;
+        for (int index = 0; index < readerCount; ++index) {
+            readers.push_back(std::thread (
+                readUntilFinished, std::cref(present), std::ref(results[index])
+            ));
+        }
+        for (std::thread & reader : readers)
+            reader.join();
+
+        double seconds = timer.nsecsElapsed() / 1000000000.0;
+
+        ReaderResult total {0, 0, 0};
+        for (ReaderResult const & result : results) {
+            total.snapshots += result.snapshots;
+            total.broken += result.broken;
+            total.backwards += result.backwards;
+        }
+
+        GenerationThinker::Snapshot snapshot = present.createSnapshot();
+        GenerationThinkerData const & last = snapshot.data();
+        if (not last.isIntact() or last.generation != generations) {
+            out << "FAILED: the final snapshot is generation "
+                << last.generation << endl;
+            failed = true;
+        }
+
+        out << (published ? "  published: " : "  locked:    ")
+            << (generations / seconds) << " writes/s, "
+            << (total.snapshots / seconds) << " snapshots/s, "
+            << (versionsFreed.load() - freedBefore) << " versions freed"
+            << endl;
+
+        if (total.broken != 0 or total.backwards != 0) {
+            out << "FAILED: " << total.broken << " snapshots were freed or "
+                << "torn while held, " << total.backwards
+                << " went backwards" << endl;
+            failed = true;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+//
+// Microbenchmark for how well status queries on Presents scale across
+// cores.  It starts a large number of thinkers (most of which just sit in
+// the executor's queue, since they never finish on their own) and then has
+// many threads hammer Present::isFinished() on all of them at once.
+//
+// usage: registrybench [thinkers] [pollingThreads] [rounds]
+//
+
+#include <atomic>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QThread>
+
+#include "thinkerqt/thinker.h"
+
+
+class IdleThinkerData : public SnapshottableData
+{
+public:
+    IdleThinkerData ()
+    { }
+
+    IdleThinkerData (const IdleThinkerData& other)
+        : SnapshottableData (other)
+    { }
+};
+
+
+class IdleThinker : public Thinker<IdleThinkerData>
+{
+protected:
+    virtual bool start() override {
+        //
+        // Hang onto the pool thread until canceled.  The timed wait means
+        // this doesn't burn any CPU the polling threads could be using.
+        //
+        while (not wasPauseRequested(100))
+            continue;
+        return false;
+    }
+};
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app (argc, argv);
+    QStringList args = app.arguments();
+
+    int thinkerCount = args.size() > 1 ? args[1].toInt() : 10000;
+    int pollerCount = args.size() > 2 ? args[2].toInt() : 64;
+    int rounds = args.size() > 3 ? args[3].toInt() : 100;
+
+    QTextStream out (stdout);
+
+    std::vector<IdleThinker::Present> presents;
+    presents.reserve(thinkerCount);
+    for (int index = 0; index < thinkerCount; ++index)
+        presents.push_back(ThinkerQt::run<IdleThinker>());
+
+    std::atomic<qint64> totalPolls (0);
+    std::atomic<int> finishedCount (0);
+    std::vector<QThread *> pollers;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int poller = 0; poller < pollerCount; ++poller) {
+        QThread * thread = QThread::create([&, poller]() {
+            qint64 polls = 0;
+            int finished = 0;
+
+            // Start each poller at a different place, so they aren't all
+            // reading the same thinker at the same moment
+            //
+            int offset = (poller * thinkerCount) / pollerCount;
+            for (int round = 0; round < rounds; ++round) {
+                for (int index = 0; index < thinkerCount; ++index) {
+                    int which = (offset + index) % thinkerCount;
+                    if (presents[which].isFinished())
+                        ++finished;
+                    ++polls;
+                }
+            }
+
+            totalPolls += polls;
+            finishedCount += finished;
+        });
+        thread->start();
+        pollers.push_back(thread);
+    }
+
+    for (QThread * thread : pollers) {
+        thread->wait();
+        delete thread;
+    }
+
+    qint64 elapsed = timer.nsecsElapsed();
+
+    out << thinkerCount << " thinkers, "
+        << pollerCount << " polling threads, "
+        << totalPolls.load() << " calls to isFinished() in "
+        << (elapsed / 1000000) << " ms" << endl;
+    out << "  " << (totalPolls.load() * 1000000000.0 / elapsed / 1000000.0)
+        << " million calls per second" << endl;
+    out << "  " << (elapsed / static_cast<double>(totalPolls.load()))
+        << " ns per call (wall clock, all threads)" << endl;
+
+    // (none of them should have finished, but reading the count keeps the
+    // calls from being optimized out)
+    //
+    out << "  " << finishedCount.load() << " finished" << endl;
+
+    for (IdleThinker::Present & present : presents)
+        present.cancel();
+
+    return 0;
+}
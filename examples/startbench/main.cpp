@@ -0,0 +1,154 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+//
+// Benchmark for how long it takes a thinker to start: the time from run()
+// to the first line of its start().  It is measured twice, once with the
+// manager thread going straight back to its event loop, and once with the
+// manager thread busy (not processing events) for a while after each run(),
+// the way a GUI thread is while it paints.
+//
+// Back when a pool thread had to wait for the manager's event loop to push
+// a thinker over to it, the busy case came out to about busyMs per start.
+// Now it should be close to the idle case.
+//
+// Only the API that has been around from the start is used, so this builds
+// against older versions of the library for comparison.
+//
+// usage: startbench [starts] [busyMs]
+//
+
+#include <algorithm>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include "thinkerqt/thinker.h"
+
+
+// One clock for every thread, so times taken on different ones compare
+//
+static QElapsedTimer benchClock;
+
+
+class StartThinkerData : public SnapshottableData
+{
+public:
+    StartThinkerData ()
+        : waitedNs (0)
+    { }
+
+    StartThinkerData (const StartThinkerData& other)
+        : SnapshottableData (other),
+        waitedNs (other.waitedNs)
+    { }
+
+    qint64 waitedNs;
+};
+
+
+//
+// Constructed right before being run, so it knows when that was
+//
+class StartThinker : public Thinker<StartThinkerData>
+{
+public:
+    StartThinker ()
+        : queuedNs (benchClock.nsecsElapsed())
+    { }
+
+protected:
+    virtual bool start() override {
+        qint64 startedNs = benchClock.nsecsElapsed();
+
+        lockForWrite();
+        writable().waitedNs = startedNs - queuedNs;
+        unlock();
+        return true;
+    }
+
+private:
+    qint64 queuedNs;
+};
+
+
+static void report(
+    QTextStream & out,
+    char const * label,
+    std::vector<qint64> & waits
+){
+    std::sort(waits.begin(), waits.end());
+
+    qint64 total = 0;
+    for (qint64 wait : waits)
+        total += wait;
+
+    out << label
+        << "mean " << (total / double(waits.size()) / 1000.0) << " us, "
+        << "p50 " << (waits[waits.size() / 2] / 1000.0) << " us, "
+        << "max " << (waits.back() / 1000.0) << " us" << endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app (argc, argv);
+    QStringList args = app.arguments();
+
+    int starts = args.size() > 1 ? args[1].toInt() : 200;
+    int busyMs = args.size() > 2 ? args[2].toInt() : 20;
+
+    QTextStream out (stdout);
+
+    benchClock.start();
+
+    for (int busy = 0; busy <= 1; ++busy) {
+        std::vector<qint64> waits;
+
+        for (int index = 0; index < starts; ++index) {
+            StartThinker::Present present = ThinkerQt::run<StartThinker>();
+
+            // Hog the manager thread without running its event loop
+            //
+            if (busy) {
+                QElapsedTimer timer;
+                timer.start();
+                while (timer.elapsed() < busyMs)
+                    continue;
+            }
+
+            while (not present.isFinished())
+                QCoreApplication::processEvents();
+
+            waits.push_back(present.createSnapshot().data().waitedNs);
+        }
+
+        report(
+            out,
+            busy ? "  manager busy: " : "  manager idle: ",
+            waits
+        );
+    }
+
+    return 0;
+}
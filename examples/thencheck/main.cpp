@@ -0,0 +1,196 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+//
+// Checks pipelines made with then().  The .pro file builds with
+// THINKERQT_CHECKED, so the thread checks are on: the second thinker is
+// constructed on the pool thread the first one ended on, and every Present
+// involved has to be destroyed on the thread that made it.  A check that
+// fails stops the program, so getting to the end is what passing means.
+//
+// Each round runs a thinker that sums up to some number and chains one
+// after it that doubles the sum.  It's done once while the first thinker is
+// still running, and once after it already finished (when then() does its
+// work right away on this thread).
+//
+// usage: thencheck [rounds] [timeoutMs]
+//
+
+#include <vector>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QThread>
+
+#include "thinkerqt/thinker.h"
+
+
+class NumberThinkerData : public SnapshottableData
+{
+public:
+    NumberThinkerData ()
+        : number (0)
+    { }
+
+    NumberThinkerData (const NumberThinkerData& other)
+        : SnapshottableData (other),
+        number (other.number)
+    { }
+
+    qint64 number;
+};
+
+
+class SumThinker : public Thinker<NumberThinkerData>
+{
+public:
+    SumThinker (qint64 upTo)
+        : upTo (upTo)
+    { }
+
+protected:
+    virtual bool start() override {
+        qint64 sum = 0;
+        for (qint64 value = 1; value <= upTo; ++value) {
+            if (wasPauseRequested())
+                return false;
+            sum += value;
+        }
+
+        lockForWrite();
+        writable().number = sum;
+        unlock();
+        return true;
+    }
+
+private:
+    qint64 upTo;
+};
+
+
+class DoubleThinker : public Thinker<NumberThinkerData>
+{
+public:
+    DoubleThinker (qint64 number)
+        : number (number)
+    { }
+
+protected:
+    virtual bool start() override {
+        lockForWrite();
+        writable().number = number * 2;
+        unlock();
+        return true;
+    }
+
+private:
+    qint64 number;
+};
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app (argc, argv);
+    QStringList args = app.arguments();
+
+    int rounds = args.size() > 1 ? args[1].toInt() : 100;
+    int timeoutMs = args.size() > 2 ? args[2].toInt() : 10000;
+
+    QTextStream out (stdout);
+
+    QThread * mainThread = QThread::currentThread();
+
+    for (int finishedFirst = 0; finishedFirst <= 1; ++finishedFirst) {
+        std::vector<SumThinker::Present> firsts;
+        std::vector<DoubleThinker::Present> seconds;
+        bool startedOffThread = false;
+
+        for (int index = 0; index < rounds; ++index) {
+            qint64 upTo = 100000 + index;
+            firsts.push_back(ThinkerQt::run<SumThinker>(upTo));
+
+            if (finishedFirst)
+                firsts.back().waitForFinished();
+
+            firsts.back().then<DoubleThinker>(
+                [](SumThinker::Snapshot const & snapshot) {
+                    return unique_ptr<DoubleThinker> (
+                        new DoubleThinker (snapshot.data().number)
+                    );
+                },
+                [&seconds, &startedOffThread, mainThread](
+                    DoubleThinker::Present present
+                ){
+                    if (QThread::currentThread() != mainThread)
+                        startedOffThread = true;
+                    seconds.push_back(present);
+                }
+            );
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        while (true) {
+            QCoreApplication::processEvents();
+
+            bool done = (seconds.size() == firsts.size());
+            for (DoubleThinker::Present & second : seconds)
+                done = done and second.isFinished();
+            if (done)
+                break;
+
+            if (timer.elapsed() > timeoutMs) {
+                out << "FAILED: only " << int (seconds.size()) << " of "
+                    << rounds << " chained thinkers started" << endl;
+                return 1;
+            }
+        }
+
+        if (startedOffThread) {
+            out << "FAILED: started wasn't called on the main thread" << endl;
+            return 1;
+        }
+
+        // The order the second thinkers were started in isn't known, but
+        // the set of results is
+        //
+        qint64 expected = 0;
+        for (SumThinker::Present & first : firsts)
+            expected += first.createSnapshot().data().number * 2;
+
+        qint64 actual = 0;
+        for (DoubleThinker::Present & second : seconds)
+            actual += second.createSnapshot().data().number;
+
+        if (actual != expected) {
+            out << "FAILED: chained results add up to " << actual
+                << " instead of " << expected << endl;
+            return 1;
+        }
+
+        out << rounds << " pipelines of two thinkers "
+            << (finishedFirst ? "(first already finished) " : "")
+            << "ran with the checks on" << endl;
+    }
+
+    return 0;
+}
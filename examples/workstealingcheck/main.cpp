@@ -0,0 +1,298 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+//
+// Checks WorkStealingExecutor under the global manager.  The .pro file
+// builds with THINKERQT_CHECKED, so the thread checks are on.  The thread
+// count and stack size are set on the manager before the executor is put
+// in, and have to carry over to it.
+//
+// Thinkers started from here go through the injection queue.  Work queued
+// from inside a thinker goes onto its worker's own deque instead, so that
+// is checked in two ways: thinkers that split themselves up with
+// parallelFor(), whose helpers are queued from the thinker's thread, and
+// then() pipelines, whose second thinkers are queued from the thread the
+// first one ended on.  Every result is checked.  A check that fails stops
+// the program.
+//
+// usage: workstealingcheck [thinkers] [threads] [timeoutMs]
+//
+
+#include <vector>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QTextStream>
+#include <QThread>
+
+#include "thinkerqt/thinker.h"
+#include "thinkerqt/workstealingexecutor.h"
+
+
+//
+// The threads that some part of the check ran on
+//
+struct ThreadLog {
+    QMutex mutex;
+    QSet<QThread *> threads;
+
+    void add() {
+        QMutexLocker lock (&mutex);
+        threads.insert(QThread::currentThread());
+    }
+
+    int count() {
+        QMutexLocker lock (&mutex);
+        return threads.size();
+    }
+};
+
+
+class NumberThinkerData : public SnapshottableData
+{
+public:
+    NumberThinkerData ()
+        : number (0)
+    { }
+
+    NumberThinkerData (const NumberThinkerData& other)
+        : SnapshottableData (other),
+        number (other.number)
+    { }
+
+    qint64 number;
+};
+
+
+//
+// Sums 1 through upTo, either on its own or in chunks with parallelFor()
+//
+class SumThinker : public Thinker<NumberThinkerData>
+{
+public:
+    SumThinker (qint64 upTo, bool parallel, ThreadLog & log)
+        : upTo (upTo), parallel (parallel), log (log)
+    { }
+
+protected:
+    virtual bool start() override {
+        log.add();
+
+        if (not parallel) {
+            qint64 sum = 0;
+            for (qint64 value = 1; value <= upTo; ++value) {
+                if (wasPauseRequested())
+                    return false;
+                sum += value;
+            }
+
+            lockForWrite();
+            writable().number = sum;
+            unlock();
+            return true;
+        }
+
+        std::atomic<qint64> sum (0);
+        bool whole = parallelFor(1, upTo + 1, 1000,
+            [this, &sum](int chunkBegin, int chunkEnd) {
+                log.add();
+                qint64 chunkSum = 0;
+                for (qint64 value = chunkBegin; value < chunkEnd; ++value)
+                    chunkSum += value;
+                sum += chunkSum;
+            }
+        );
+        if (not whole)
+            return false;
+
+        lockForWrite();
+        writable().number = sum.load();
+        unlock();
+        return true;
+    }
+
+private:
+    qint64 upTo;
+    bool parallel;
+    ThreadLog & log;
+};
+
+
+class DoubleThinker : public Thinker<NumberThinkerData>
+{
+public:
+    DoubleThinker (qint64 number, ThreadLog & log)
+        : number (number), log (log)
+    { }
+
+protected:
+    virtual bool start() override {
+        log.add();
+
+        lockForWrite();
+        writable().number = number * 2;
+        unlock();
+        return true;
+    }
+
+private:
+    qint64 number;
+    ThreadLog & log;
+};
+
+
+static qint64 sumUpTo(qint64 upTo) {
+    return upTo * (upTo + 1) / 2;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app (argc, argv);
+    QStringList args = app.arguments();
+
+    int count = args.size() > 1 ? args[1].toInt() : 1000;
+    int threads = args.size() > 2 ? args[2].toInt() : 4;
+    int timeoutMs = args.size() > 3 ? args[3].toInt() : 10000;
+
+    QTextStream out (stdout);
+
+    uint const stackSize = 512 * 1024;
+
+    ThinkerManager & mgr = ThinkerManager::getGlobalManager();
+    mgr.setMaxThreadCount(threads);
+    mgr.setStackSize(stackSize);
+    mgr.setExecutor(unique_ptr<ThinkerExecutor> (new WorkStealingExecutor ()));
+
+    if (mgr.maxThreadCount() != threads or mgr.stackSize() != stackSize) {
+        out << "FAILED: the executor has " << mgr.maxThreadCount()
+            << " threads and a stack size of " << qint64 (mgr.stackSize())
+            << " instead of what was set on the manager" << endl;
+        return 1;
+    }
+
+    // Short thinkers, all queued from here
+    //
+    ThreadLog shortLog;
+    std::vector<SumThinker::Present> shorts;
+    for (int index = 0; index < count; ++index)
+        shorts.push_back(ThinkerQt::run<SumThinker>(index, false, shortLog));
+
+    for (int index = 0; index < count; ++index) {
+        shorts[index].waitForFinished();
+        qint64 sum = shorts[index].createSnapshot().data().number;
+        if (sum != sumUpTo(index)) {
+            out << "FAILED: short thinker " << index << " came out to "
+                << sum << endl;
+            return 1;
+        }
+    }
+
+    out << count << " short thinkers ran on " << shortLog.count()
+        << " threads" << endl;
+
+    // Thinkers whose chunks are queued from the workers themselves
+    //
+    ThreadLog parallelLog;
+    int parallelCount = qMax(count / 100, 1);
+    std::vector<SumThinker::Present> parallels;
+    for (int index = 0; index < parallelCount; ++index) {
+        parallels.push_back(ThinkerQt::run<SumThinker>(
+            100000 + index, true, parallelLog
+        ));
+    }
+
+    for (int index = 0; index < parallelCount; ++index) {
+        parallels[index].waitForFinished();
+        qint64 sum = parallels[index].createSnapshot().data().number;
+        if (sum != sumUpTo(100000 + index)) {
+            out << "FAILED: parallel thinker " << index << " came out to "
+                << sum << endl;
+            return 1;
+        }
+    }
+
+    out << parallelCount << " parallelFor() thinkers ran their chunks on "
+        << parallelLog.count() << " threads" << endl;
+
+    // Pipelines whose second thinkers are queued from the workers
+    //
+    ThreadLog firstLog;
+    ThreadLog secondLog;
+    std::vector<SumThinker::Present> firsts;
+    std::vector<DoubleThinker::Present> seconds;
+    for (int index = 0; index < count; ++index) {
+        firsts.push_back(ThinkerQt::run<SumThinker>(index, false, firstLog));
+        firsts.back().then<DoubleThinker>(
+            [&secondLog](SumThinker::Snapshot const & snapshot) {
+                return unique_ptr<DoubleThinker> (
+                    new DoubleThinker (snapshot.data().number, secondLog)
+                );
+            },
+            [&seconds](DoubleThinker::Present present) {
+                seconds.push_back(present);
+            }
+        );
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    while (true) {
+        QCoreApplication::processEvents();
+
+        bool done = (seconds.size() == firsts.size());
+        for (DoubleThinker::Present & second : seconds)
+            done = done and second.isFinished();
+        if (done)
+            break;
+
+        if (timer.elapsed() > timeoutMs) {
+            out << "FAILED: only " << int (seconds.size()) << " of "
+                << count << " chained thinkers started" << endl;
+            return 1;
+        }
+    }
+
+    // The order the second thinkers were started in isn't known, but the
+    // set of results is
+    //
+    qint64 expected = 0;
+    for (int index = 0; index < count; ++index)
+        expected += sumUpTo(index) * 2;
+
+    qint64 actual = 0;
+    for (DoubleThinker::Present & second : seconds)
+        actual += second.createSnapshot().data().number;
+
+    if (actual != expected) {
+        out << "FAILED: chained results add up to " << actual
+            << " instead of " << expected << endl;
+        return 1;
+    }
+
+    out << count << " pipelines of two thinkers ran on " << firstLog.count()
+        << " and " << secondLog.count() << " threads" << endl;
+
+    return 0;
+}
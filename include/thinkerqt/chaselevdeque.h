@@ -0,0 +1,203 @@
+//
+// chaselevdeque.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_CHASELEVDEQUE_H
+#define THINKERQT_CHASELEVDEQUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <QtGlobal>
+
+#include "defs.h"
+
+//
+// ChaseLevDeque
+//
+// A lock-free work-stealing deque, as described in "Dynamic Circular
+// Work-Stealing Deque" (Chase and Lev, SPAA 2005), using the C11 memory
+// orderings worked out in "Correct and Efficient Work-Stealing for Weak
+// Memory Models" (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013).
+//
+// Only the owning thread may push() and pop(), which work on the bottom end
+// in LIFO order.  Any thread may steal(), which takes from the top in FIFO
+// order.  The circular buffer grows but never shrinks; buffers that have
+// been outgrown are kept until the deque is destroyed, because a thief may
+// still be reading from one.
+//
+// The element type must be trivially copyable (it's stored in std::atomic),
+// which in practice means a pointer.
+//
+
+template <class T>
+class ChaseLevDeque
+{
+  private:
+    class Buffer {
+      public:
+        Buffer (std::int64_t capacity) :
+            _capacity (capacity),
+            _mask (capacity - 1),
+            _slots (new std::atomic<T>[capacity])
+        {
+        }
+
+        ~Buffer ()
+          { delete[] _slots; }
+
+      public:
+        std::int64_t capacity() const
+          { return _capacity; }
+
+        T get(std::int64_t index) const
+          { return _slots[index & _mask].load(std::memory_order_relaxed); }
+
+        void put(std::int64_t index, T value)
+          { _slots[index & _mask].store(value, std::memory_order_relaxed); }
+
+        Buffer * grow(std::int64_t bottom, std::int64_t top) const {
+            Buffer * result = new Buffer (_capacity * 2);
+            for (std::int64_t index = top; index < bottom; ++index)
+                result->put(index, get(index));
+            return result;
+        }
+
+      private:
+        std::int64_t const _capacity;  // always a power of two
+        std::int64_t const _mask;
+        std::atomic<T> * _slots;
+    };
+
+  public:
+    ChaseLevDeque (std::int64_t initialCapacity = 64) :
+        _top (0),
+        _bottom (0),
+        _buffer (new Buffer (initialCapacity))
+    {
+        hopefully((initialCapacity & (initialCapacity - 1)) == 0, HERE);
+    }
+
+    ChaseLevDeque (ChaseLevDeque const & other) = delete;
+
+    ~ChaseLevDeque ()
+    {
+        delete _buffer.load(std::memory_order_relaxed);
+        for (Buffer * retired : _retired)
+            delete retired;
+    }
+
+  public:
+    // Owner only
+    //
+    void push(T value) {
+        std::int64_t bottom = _bottom.load(std::memory_order_relaxed);
+        std::int64_t top = _top.load(std::memory_order_acquire);
+        Buffer * buffer = _buffer.load(std::memory_order_relaxed);
+
+        if (bottom - top > buffer->capacity() - 1) {
+            _retired.push_back(buffer);
+            buffer = buffer->grow(bottom, top);
+            _buffer.store(buffer, std::memory_order_release);
+        }
+
+        // The paper has a release fence and then a relaxed store.  A release
+        // store orders the same way, and unlike the fence it is something
+        // ThreadSanitizer can see pair up with the thieves' acquire load.
+        //
+        buffer->put(bottom, value);
+        _bottom.store(bottom + 1, std::memory_order_release);
+    }
+
+    // Owner only
+    //
+    bool pop(T & value) {
+        std::int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+        Buffer * buffer = _buffer.load(std::memory_order_relaxed);
+        _bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t top = _top.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            //
+            // Was already empty
+            //
+            _bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        value = buffer->get(bottom);
+        if (top != bottom)
+            return true;  // more than one item left, no race with thieves
+
+        // Last item; we race any thieves for it by bumping the top
+        //
+        bool won = _top.compare_exchange_strong(
+            top, top + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed
+        );
+        _bottom.store(bottom + 1, std::memory_order_relaxed);
+        return won;
+    }
+
+    // Any thread.  May fail spuriously if it loses a race with the owner or
+    // another thief, so a false result does not mean the deque is empty.
+    //
+    bool steal(T & value) {
+        std::int64_t top = _top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t bottom = _bottom.load(std::memory_order_acquire);
+
+        if (top >= bottom)
+            return false;
+
+        // (The paper uses memory_order_consume here, which compilers just
+        // promote to acquire anyway)
+        //
+        Buffer * buffer = _buffer.load(std::memory_order_acquire);
+        T result = buffer->get(top);
+        if (not _top.compare_exchange_strong(
+            top, top + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed
+        )){
+            return false;
+        }
+
+        value = result;
+        return true;
+    }
+
+    // Only a hint when called concurrently with push/pop/steal
+    //
+    bool isEmpty() const {
+        std::int64_t bottom = _bottom.load(std::memory_order_relaxed);
+        std::int64_t top = _top.load(std::memory_order_relaxed);
+        return bottom <= top;
+    }
+
+  private:
+    std::atomic<std::int64_t> _top;
+    std::atomic<std::int64_t> _bottom;
+    std::atomic<Buffer *> _buffer;
+    std::vector<Buffer *> _retired;  // touched by the owner only
+};
+
+#endif
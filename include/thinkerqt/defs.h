@@ -33,6 +33,39 @@ using std::shared_ptr;
 using std::unique_ptr;
 using std::make_shared;
 
+// THINKERQT_CHECKED controls whether the hopefully() assertions and the
+// thread identity checks that use them actually run.  By default they do
+// in debug builds, and compile away to nothing when QT_NO_DEBUG is set (as
+// qmake does in release builds).  Define it as 0 or 1 to override that.
+//
+// It only affects the substitute definitions below; hoist has its own
+// configuration for such things.
+
+#ifndef THINKERQT_CHECKED
+    #ifdef QT_NO_DEBUG
+        #define THINKERQT_CHECKED 0
+    #else
+        #define THINKERQT_CHECKED 1
+    #endif
+#endif
+
+// Thinkers can report progress the way a QFuture does (a value within a
+// range, plus some text), for showing a progress bar without taking a whole
+// snapshot.  It costs a few atomics per thinker; define this as 0 to leave
+// it out.
+
+#ifndef OFFER_PROGRESS_API_LIKE_QFUTURE
+    #define OFFER_PROGRESS_API_LIKE_QFUTURE 1
+#endif
+
+// Thinkers can also stream out a list of results the way a QFuture does,
+// through ThinkerResults and ThinkerResultReader (see thinkerresults.h).
+// Define this as 0 to leave them out.
+
+#ifndef RETURN_LIST_OF_RESULTS_LIKE_QFUTURE
+    #define RETURN_LIST_OF_RESULTS_LIKE_QFUTURE 1
+#endif
+
 #if THINKERQT_USE_HOIST
     //
     // The hoist library is something that I use as an alternative system for
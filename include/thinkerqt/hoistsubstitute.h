@@ -22,6 +22,8 @@
 #ifndef THINKERQT_HOISTSUBSTITUTE_H
 #define THINKERQT_HOISTSUBSTITUTE_H
 
+#include <cstddef>
+
 // These definitions are stubs which let you build Thinker-Qt without hoist,
 // turning the hoist features into simple asserts
 //
@@ -29,6 +31,8 @@
 
 namespace hoist {
 
+#if THINKERQT_CHECKED
+
 struct codeplace
 {
     char const * filename;
@@ -50,11 +54,25 @@ struct codeplace
 
 #define HERE codeplace (__FILE__, __LINE__, __FUNCTION__)
 
+#else
+
+// When unchecked there's no use for the location, so a codeplace is empty
+// and building one for HERE costs nothing
+
+struct codeplace
+{
+};
+
+#define HERE codeplace ()
+
+#endif
+
 #define PLACE(str) HERE
 
 
 inline bool hopefullyNotReached(char const * message, codeplace const & cp)
 {
+  #if THINKERQT_CHECKED
     qt_assert_x(message, cp.function, cp.filename, cp.line);
 
     qFatal(
@@ -64,11 +82,20 @@ inline bool hopefullyNotReached(char const * message, codeplace const & cp)
         cp.filename,
         cp.line
     );
+  #else
+    // Code that is really reached when it shouldn't be still stops the
+    // program, since there is no sensible way to continue
+    //
+    Q_UNUSED(cp);
+    qFatal("%s", message);
+  #endif
 
     return false;
 }
 
 
+#if THINKERQT_CHECKED
+
 inline bool hopefully(bool condition, codeplace const & cp)
 {
     if (not condition) {
@@ -78,6 +105,22 @@ inline bool hopefully(bool condition, codeplace const & cp)
     return true;
 }
 
+#else
+
+// Neither argument is evaluated, so the condition must not have any side
+// effects the program depends on.  (Putting them under sizeof just keeps
+// variables used only in assertions from causing "unused" warnings.)
+
+inline bool hopefullyUnchecked(std::size_t, std::size_t)
+{
+    return true;
+}
+
+#define hopefully(condition, cp) \
+    hoist::hopefullyUnchecked(sizeof((condition)), sizeof((cp)))
+
+#endif
+
 
 inline bool hopefullyNotReached(codeplace const & cp)
 {
@@ -0,0 +1,687 @@
+//
+// persistentcontainers.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_PERSISTENTCONTAINERS_H
+#define THINKERQT_PERSISTENTCONTAINERS_H
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include <QHash>
+#include <QVector>
+#include <QtGlobal>
+
+#include "defs.h"
+
+//
+// Containers for large collections inside a SnapshottableData.
+//
+// A write to a Snapshottable while a snapshot is held copies the DataType,
+// and a QVector or QHash in it gets copied along with it: O(n) for every
+// write, no matter how little changed.  These containers are trees of
+// shared nodes instead.  Copying one only copies a pointer to its root, and
+// a write copies just the nodes on the path down to what changed, which is
+// O(log n) and touches a handful of nodes even for millions of items.
+//
+// Nodes that aren't shared with anything (because no snapshot was taken
+// since the last write) are changed in place, so a thinker that writes many
+// times between snapshots doesn't pay for a path copy each time.
+//
+// Like the rest of a DataType, a container may be read from any number of
+// threads at once but only written by the one holding it for write.
+//
+
+namespace persistent_detail {
+
+    // Whether node can be changed in place.  Only this container holds it
+    // if the count is one, and nothing else can get it from us while we're
+    // looking.  The fence pairs with the release done by whichever thread
+    // (say, one dropping a snapshot) let go of it last, so what that thread
+    // read happens before what we are about to write.
+    //
+    template <class Node>
+    bool isExclusive(shared_ptr<Node> const & node) {
+        if (node.use_count() != 1)
+            return false;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+
+    // A node's count only says who points at it directly, so one with a
+    // count of one is still shared if it's under a node that is.  Callers
+    // that look at a child before making its parent editable pass in
+    // whether anything above it was shared.
+    //
+    template <class Node>
+    shared_ptr<Node> editable(
+        shared_ptr<Node> const & node,
+        bool underShared = false
+    ){
+        if (not underShared and isExclusive(node))
+            return node;
+        return make_shared<Node>(*node);
+    }
+
+    inline int bitCount(quint32 bits)
+      { return qPopulationCount(bits); }
+
+} // end namespace persistent_detail
+
+
+//
+// PersistentVector
+//
+// A vector as a tree 32 items wide at each level, where an item's index
+// spells out the path to it five bits at a time.  The last (up to) 32 items
+// are kept in a "tail" outside of the tree, so appending usually touches
+// one node and only goes into the tree every 32nd time.
+//
+// That makes at() and set() O(log32 n), which is at most 7 steps for an
+// int index.  There's no concatenation or slicing (which is what relaxing
+// the radix balance would buy); items can only be added or removed at the
+// end.
+//
+
+template <class T>
+class PersistentVector
+{
+  private:
+    static const int bits = 5;
+    static const int width = 1 << bits;
+    static const int mask = width - 1;
+
+    // Leaves only use values, branches only use children
+    //
+    struct Node {
+        std::vector<shared_ptr<Node>> children;
+        std::vector<T> values;
+    };
+
+  public:
+    PersistentVector () :
+        _size (0),
+        _shift (bits),
+        _root (make_shared<Node>()),
+        _tail (make_shared<Node>())
+      { }
+
+  public:
+    int size() const
+      { return _size; }
+
+    bool isEmpty() const
+      { return _size == 0; }
+
+    T const & at(int index) const {
+        hopefully(index >= 0 and index < _size, HERE);
+        return leafFor(index)->values[index & mask];
+    }
+
+    T const & operator[](int index) const
+      { return at(index); }
+
+    T const & last() const
+      { return at(_size - 1); }
+
+  public:
+    void set(int index, T const & value) {
+        hopefully(index >= 0 and index < _size, HERE);
+
+        if (index >= tailOffset()) {
+            _tail = persistent_detail::editable(_tail);
+            _tail->values[index & mask] = value;
+            return;
+        }
+
+        _root = setIn(_shift, _root, index, value);
+    }
+
+    void append(T const & value) {
+        if (_size - tailOffset() < width) {
+            _tail = persistent_detail::editable(_tail);
+            _tail->values.push_back(value);
+            ++_size;
+            return;
+        }
+
+        // The tail is full, so it goes into the tree (a new level is needed
+        // once the root has no room left for it)
+        //
+        if ((_size >> bits) > (1 << _shift)) {
+            shared_ptr<Node> root = make_shared<Node>();
+            root->children.push_back(_root);
+            root->children.push_back(pathTo(_shift, _tail));
+            _root = root;
+            _shift += bits;
+        }
+        else
+            _root = pushTail(_shift, _root, _tail);
+
+        _tail = make_shared<Node>();
+        _tail->values.reserve(width);
+        _tail->values.push_back(value);
+        ++_size;
+    }
+
+    void removeLast() {
+        hopefully(_size > 0, HERE);
+
+        if (_size == 1) {
+            clear();
+            return;
+        }
+
+        if (_size - tailOffset() > 1) {
+            _tail = persistent_detail::editable(_tail);
+            _tail->values.pop_back();
+            --_size;
+            return;
+        }
+
+        // The tail is about to be empty, so the last leaf in the tree comes
+        // out to be the new one
+        //
+        shared_ptr<Node> tail = leafFor(_size - 2);
+
+        shared_ptr<Node> root = popTail(_shift, _root);
+        if (root == nullptr)
+            root = make_shared<Node>();
+        if (_shift > bits and root->children.size() == 1) {
+            root = root->children[0];
+            _shift -= bits;
+        }
+
+        _root = root;
+        _tail = tail;
+        --_size;
+    }
+
+    void clear() {
+        _size = 0;
+        _shift = bits;
+        _root = make_shared<Node>();
+        _tail = make_shared<Node>();
+    }
+
+  public:
+    // Calls fn(item) on each item in order, a leaf at a time
+    //
+    template <class Fn>
+    void forEach(Fn fn) const {
+        int index = 0;
+        while (index < _size) {
+            shared_ptr<Node> const & leaf = leafFor(index);
+            for (T const & value : leaf->values)
+                fn(value);
+            index += static_cast<int>(leaf->values.size());
+        }
+    }
+
+    QVector<T> toVector() const {
+        QVector<T> vector;
+        vector.reserve(_size);
+        forEach([&vector](T const & value) { vector.append(value); });
+        return vector;
+    }
+
+  private:
+    // Items from here on are in the tail
+    //
+    int tailOffset() const
+      { return _size < width ? 0 : ((_size - 1) >> bits) << bits; }
+
+    shared_ptr<Node> const & leafFor(int index) const {
+        if (index >= tailOffset())
+            return _tail;
+
+        Node const * node = _root.get();
+        for (int level = _shift; level > bits; level -= bits)
+            node = node->children[(index >> level) & mask].get();
+        return node->children[(index >> bits) & mask];
+    }
+
+    shared_ptr<Node> setIn(
+        int level,
+        shared_ptr<Node> const & node,
+        int index,
+        T const & value
+    ){
+        shared_ptr<Node> result = persistent_detail::editable(node);
+        if (level == 0)
+            result->values[index & mask] = value;
+        else {
+            int child = (index >> level) & mask;
+            result->children[child] = setIn(
+                level - bits, result->children[child], index, value
+            );
+        }
+        return result;
+    }
+
+    // A chain of single-child branches from level down to the leaf
+    //
+    static shared_ptr<Node> pathTo(int level, shared_ptr<Node> const & leaf) {
+        if (level == 0)
+            return leaf;
+        shared_ptr<Node> result = make_shared<Node>();
+        result->children.push_back(pathTo(level - bits, leaf));
+        return result;
+    }
+
+    shared_ptr<Node> pushTail(
+        int level,
+        shared_ptr<Node> const & node,
+        shared_ptr<Node> const & leaf
+    ){
+        shared_ptr<Node> result = persistent_detail::editable(node);
+        size_t child = ((_size - 1) >> level) & mask;
+
+        shared_ptr<Node> insert;
+        if (level == bits)
+            insert = leaf;
+        else if (child < result->children.size())
+            insert = pushTail(level - bits, result->children[child], leaf);
+        else
+            insert = pathTo(level - bits, leaf);
+
+        if (child < result->children.size())
+            result->children[child] = insert;
+        else
+            result->children.push_back(insert);
+        return result;
+    }
+
+    // Takes the last leaf out of the tree, giving back null for a branch
+    // that it leaves empty
+    //
+    shared_ptr<Node> popTail(int level, shared_ptr<Node> const & node) {
+        //
+        // The leaf is all there is under node if its path from here down
+        // only goes through first children
+        //
+        if ((((_size - 2) >> bits) & ((1 << level) - 1)) == 0)
+            return nullptr;
+
+        shared_ptr<Node> result = persistent_detail::editable(node);
+
+        if (level > bits) {
+            int child = ((_size - 2) >> level) & mask;
+            shared_ptr<Node> newChild = popTail(
+                level - bits, result->children[child]
+            );
+            if (newChild != nullptr) {
+                result->children[child] = newChild;
+                return result;
+            }
+        }
+
+        result->children.pop_back();
+        return result;
+    }
+
+  private:
+    int _size;
+    int _shift;  // how far to shift an index for the root's child
+    shared_ptr<Node> _root;
+    shared_ptr<Node> _tail;
+};
+
+
+//
+// PersistentHash
+//
+// A hash array mapped trie: the bits of a key's qHash() pick a path down a
+// tree 32 wide at each level, five bits at a time.  Each node keeps bitmaps
+// of which of its 32 slots are in use (by an item or by a child node), and
+// only stores those, so sparse nodes stay small.  Keys whose hashes are the
+// same all the way down share a node that is searched in order.
+//
+// value(), contains(), insert() and remove() are all O(log32 n).  Iteration
+// order is by hash, like QHash's, so it can't be counted on.
+//
+
+template <class K, class V>
+class PersistentHash
+{
+  private:
+    static const int bits = 5;
+    static const int mask = (1 << bits) - 1;
+    static const int hashBits = 32;
+
+    // Nodes at shift hashBits or more are collision nodes, which only have
+    // items and no bitmaps
+    //
+    struct Node {
+        Node () :
+            itemMap (0),
+            childMap (0)
+          { }
+
+        quint32 itemMap;
+        quint32 childMap;
+        std::vector<std::pair<K, V>> items;
+        std::vector<shared_ptr<Node>> children;
+    };
+
+  public:
+    PersistentHash () :
+        _size (0),
+        _root (make_shared<Node>())
+      { }
+
+  public:
+    int size() const
+      { return _size; }
+
+    bool isEmpty() const
+      { return _size == 0; }
+
+    bool contains(K const & key) const
+      { return find(key) != nullptr; }
+
+    V value(K const & key, V const & defaultValue = V ()) const {
+        V const * found = find(key);
+        return found ? *found : defaultValue;
+    }
+
+  public:
+    void insert(K const & key, V const & value) {
+        bool added = false;
+        _root = insertIn(_root, 0, hashOf(key), key, value, added);
+        if (added)
+            ++_size;
+    }
+
+    // Returns how many items were removed (0 or 1), like QHash::remove()
+    //
+    int remove(K const & key) {
+        bool removed = false;
+        shared_ptr<Node> root = removeFrom(
+            _root, false, 0, hashOf(key), key, removed
+        );
+        if (not removed)
+            return 0;
+
+        _root = root;
+        --_size;
+        return 1;
+    }
+
+    void clear() {
+        _size = 0;
+        _root = make_shared<Node>();
+    }
+
+  public:
+    // Calls fn(key, value) on each item
+    //
+    template <class Fn>
+    void forEach(Fn fn) const
+      { forEachIn(*_root, fn); }
+
+    QHash<K, V> toHash() const {
+        QHash<K, V> hash;
+        hash.reserve(_size);
+        forEach([&hash](K const & key, V const & value) {
+            hash.insert(key, value);
+        });
+        return hash;
+    }
+
+  private:
+    static quint32 hashOf(K const & key)
+      { return static_cast<quint32>(qHash(key)); }
+
+    static quint32 bitFor(quint32 hash, int shift)
+      { return quint32 (1) << ((hash >> shift) & mask); }
+
+    // Where the slot for bit goes among those in use in map
+    //
+    static int slotOf(quint32 map, quint32 bit)
+      { return persistent_detail::bitCount(map & (bit - 1)); }
+
+    V const * find(K const & key) const {
+        quint32 hash = hashOf(key);
+        Node const * node = _root.get();
+
+        for (int shift = 0; shift < hashBits; shift += bits) {
+            quint32 bit = bitFor(hash, shift);
+            if (node->itemMap & bit) {
+                auto const & item = node->items[slotOf(node->itemMap, bit)];
+                return item.first == key ? &item.second : nullptr;
+            }
+            if (not (node->childMap & bit))
+                return nullptr;
+            node = node->children[slotOf(node->childMap, bit)].get();
+        }
+
+        for (auto const & item : node->items)
+            if (item.first == key)
+                return &item.second;
+        return nullptr;
+    }
+
+    // A node holding two items whose keys differ, going as deep as it takes
+    // for their hashes to differ too
+    //
+    static shared_ptr<Node> merge(
+        std::pair<K, V> const & first,
+        quint32 firstHash,
+        std::pair<K, V> const & second,
+        quint32 secondHash,
+        int shift
+    ){
+        shared_ptr<Node> result = make_shared<Node>();
+
+        if (shift >= hashBits) {
+            result->items.push_back(first);
+            result->items.push_back(second);
+            return result;
+        }
+
+        quint32 firstBit = bitFor(firstHash, shift);
+        quint32 secondBit = bitFor(secondHash, shift);
+
+        if (firstBit == secondBit) {
+            result->childMap = firstBit;
+            result->children.push_back(
+                merge(first, firstHash, second, secondHash, shift + bits)
+            );
+            return result;
+        }
+
+        result->itemMap = firstBit | secondBit;
+        if (firstBit < secondBit) {
+            result->items.push_back(first);
+            result->items.push_back(second);
+        }
+        else {
+            result->items.push_back(second);
+            result->items.push_back(first);
+        }
+        return result;
+    }
+
+    static shared_ptr<Node> insertIn(
+        shared_ptr<Node> const & node,
+        int shift,
+        quint32 hash,
+        K const & key,
+        V const & value,
+        bool & added
+    ){
+        shared_ptr<Node> result = persistent_detail::editable(node);
+
+        if (shift >= hashBits) {
+            for (auto & item : result->items) {
+                if (item.first == key) {
+                    item.second = value;
+                    return result;
+                }
+            }
+            result->items.push_back(std::make_pair(key, value));
+            added = true;
+            return result;
+        }
+
+        quint32 bit = bitFor(hash, shift);
+
+        if (result->itemMap & bit) {
+            int slot = slotOf(result->itemMap, bit);
+            std::pair<K, V> & item = result->items[slot];
+            if (item.first == key) {
+                item.second = value;
+                return result;
+            }
+
+            // Another key has the slot, so both go down a level
+            //
+            shared_ptr<Node> child = merge(
+                item,
+                hashOf(item.first),
+                std::make_pair(key, value),
+                hash,
+                shift + bits
+            );
+            result->items.erase(result->items.begin() + slot);
+            result->itemMap &= ~bit;
+
+            result->childMap |= bit;
+            result->children.insert(
+                result->children.begin() + slotOf(result->childMap, bit),
+                child
+            );
+            added = true;
+            return result;
+        }
+
+        if (result->childMap & bit) {
+            int slot = slotOf(result->childMap, bit);
+            result->children[slot] = insertIn(
+                result->children[slot], shift + bits, hash, key, value, added
+            );
+            return result;
+        }
+
+        result->itemMap |= bit;
+        result->items.insert(
+            result->items.begin() + slotOf(result->itemMap, bit),
+            std::make_pair(key, value)
+        );
+        added = true;
+        return result;
+    }
+
+    // Nothing is copied unless the key is found.  Since the search goes
+    // down before anything is made editable, underShared says whether any
+    // node above this one is shared.
+    //
+    static shared_ptr<Node> removeFrom(
+        shared_ptr<Node> const & node,
+        bool underShared,
+        int shift,
+        quint32 hash,
+        K const & key,
+        bool & removed
+    ){
+        if (shift >= hashBits) {
+            for (size_t index = 0; index < node->items.size(); ++index) {
+                if (node->items[index].first == key) {
+                    shared_ptr<Node> result = persistent_detail::editable(
+                        node, underShared
+                    );
+                    result->items.erase(result->items.begin() + index);
+                    removed = true;
+                    return result;
+                }
+            }
+            return node;
+        }
+
+        quint32 bit = bitFor(hash, shift);
+
+        if (node->itemMap & bit) {
+            int slot = slotOf(node->itemMap, bit);
+            if (not (node->items[slot].first == key))
+                return node;
+
+            shared_ptr<Node> result = persistent_detail::editable(
+                node, underShared
+            );
+            result->items.erase(result->items.begin() + slot);
+            result->itemMap &= ~bit;
+            removed = true;
+            return result;
+        }
+
+        if (not (node->childMap & bit))
+            return node;
+
+        bool shared = underShared or not persistent_detail::isExclusive(node);
+
+        int slot = slotOf(node->childMap, bit);
+        shared_ptr<Node> child = removeFrom(
+            node->children[slot], shared, shift + bits, hash, key, removed
+        );
+        if (not removed)
+            return node;
+
+        shared_ptr<Node> result = persistent_detail::editable(
+            node, underShared
+        );
+
+        // A child left with one item (and no children) is folded into this
+        // node, and one left with nothing is dropped, so the tree doesn't
+        // keep chains of near-empty nodes around
+        //
+        if (child->children.empty() and child->items.size() <= 1) {
+            result->children.erase(result->children.begin() + slot);
+            result->childMap &= ~bit;
+
+            if (child->items.size() == 1) {
+                result->itemMap |= bit;
+                result->items.insert(
+                    result->items.begin() + slotOf(result->itemMap, bit),
+                    child->items[0]
+                );
+            }
+        }
+        else
+            result->children[slot] = child;
+
+        return result;
+    }
+
+    template <class Fn>
+    static void forEachIn(Node const & node, Fn & fn) {
+        for (auto const & item : node.items)
+            fn(item.first, item.second);
+        for (auto const & child : node.children)
+            forEachIn(*child, fn);
+    }
+
+  private:
+    int _size;
+    shared_ptr<Node> _root;
+};
+
+#endif
@@ -22,13 +22,41 @@
 #ifndef THINKERQT_SNAPSHOTTABLE_H
 #define THINKERQT_SNAPSHOTTABLE_H
 
+#include <atomic>
+
 #include <QObject>
+#include <QList>
+#include <QPair>
 #include <QSharedData>
 #include <QSharedDataPointer>
 #include <QReadWriteLock>
+#include <QRect>
+#include <QVector>
 
 #include "defs.h"
 
+
+//
+// SnapshotChanges
+//
+// One entry in the log of what each write to a Snapshottable changed (see
+// SnapshottableBase::markDirty()).  Entries are never modified once made,
+// so snapshots can share them.  Each points back at the one for the write
+// before it.  The chain is cut every so many writes, so it doesn't grow
+// forever; a snapshot from before the cut counts as too old.
+//
+
+struct SnapshotChanges
+{
+    quint64 version;
+    quint64 previousVersion;
+    bool everything;  // written without marking what changed
+    QVector<QRect> rects;
+
+    shared_ptr<SnapshotChanges const> previous;
+    int depth;  // how many entries are reachable through previous
+};
+
 //
 // SnapshottableData
 //
@@ -52,9 +80,42 @@
 class SnapshottableData : public QSharedData
 {
 public:
+    SnapshottableData () :
+        QSharedData (),
+        _version (0),
+        _changes ()
+    {
+    }
+
     virtual ~SnapshottableData ()
     {
     }
+
+public:
+    // A Snapshottable with more than one buffer (see setSnapshotBuffers())
+    // doesn't copy its data into a new object each time a write follows a
+    // snapshot.  It copies it into an old one that no snapshot holds any
+    // more, with this.  Override it to do that copy in place, reusing the
+    // storage this object already has.  (other is always of the same type
+    // as this.)  Returning false means the data can't be copied that way,
+    // and the Snapshottable falls back on copy-on-write.
+    //
+    virtual bool copyFrom (SnapshottableData const & other)
+    {
+        Q_UNUSED(other);
+        return false;
+    }
+
+private:
+    friend class SnapshotBase;
+    friend class SnapshottableBase;
+
+    // Stamped onto the data by the Snapshottable when a write is unlocked.
+    // Versions come from one counter for all Snapshottables, so a version
+    // from one never means anything to another.
+    //
+    quint64 _version;
+    shared_ptr<SnapshotChanges const> _changes;  // null if not tracked
 };
 
 
@@ -95,6 +156,20 @@ public:
     virtual void clear () = 0;
     virtual const SnapshottableData & dataBase () const = 0;
 
+public:
+    // Which write of its Snapshottable this snapshot shows
+    //
+    quint64 version () const;
+
+    // Adds the rectangles that were marked dirty by the writes between the
+    // given version (an earlier snapshot's) and this one to rects.  It may
+    // add the same area more than once.  Returns false if that can't be
+    // known, and everything should be considered changed: when the version
+    // is from another Snapshottable or too long ago, or some write didn't
+    // mark what it changed.
+    //
+    bool changedSince (quint64 version, QVector<QRect> & rects) const;
+
     // Avoids "deleting object of abstract class type 'SnapshotBase' which
     // has non-virtual destructor will cause undefined behavior" error.
     virtual ~SnapshotBase () {}
@@ -106,6 +181,52 @@ private:
 };
 
 
+//
+// SnapshotEpochs
+//
+// Epoch-based reclamation for Snapshottables that publish their versions
+// (see SnapshottableBase::PublishedSnapshots).  A reader pins the current
+// epoch while it picks up the published version and takes a reference to
+// it, which is only a few instructions.  A writer that replaces a version
+// retires the old one with the epoch it was replaced in, and only lets go
+// of it after the epoch has advanced twice.  By then no reader can still be
+// in the middle of picking it up.
+//
+// The epoch only advances when every pinned thread has seen the current
+// one, and nobody waits for that: a writer just tries to advance it each
+// time it publishes, and holds on to what it retired until it can let go.
+//
+
+class SnapshotEpochs
+{
+public:
+    class Pin
+    {
+    public:
+        Pin () { SnapshotEpochs::pin(); }
+        ~Pin () { SnapshotEpochs::unpin(); }
+
+        Pin (Pin const & other) = delete;
+        Pin & operator= (Pin const & other) = delete;
+    };
+
+    // Epochs go up by two (a pinned thread shows its epoch plus one), and
+    // wrap around
+    //
+    static unsigned current ();
+
+    // True if something retired in the given epoch can be let go of,
+    // trying to advance the epoch first if need be
+    //
+    static bool isReclaimable (unsigned retiredEpoch);
+
+private:
+    static void pin ();
+    static void unpin ();
+    static bool tryAdvance ();
+};
+
+
 //
 // SnapshottableBase
 //
@@ -123,10 +244,75 @@ private:
 
 class SnapshottableBase
 {
+public:
+    // By default, taking a snapshot takes a read lock, and lockForWrite()
+    // waits for any snapshots being taken to finish (and vice versa).  With
+    // PublishedSnapshots, unlock() instead publishes the data as a new
+    // version with an atomic pointer swap.  Snapshots are made from the last
+    // version published, and neither side ever waits for the other.
+    //
+    // The cost is that the first write after each unlock() copies the data
+    // (it is copy-on-write, and the published version holds a reference).
+    // So it is for thinkers whose data is cheap to copy, or that write in
+    // big batches between unlocks.
+    //
+    enum SnapshotPolicy {
+        LockedSnapshots,
+        PublishedSnapshots
+    };
+
 public:
     SnapshottableBase ();
     virtual ~SnapshottableBase ();
 
+public:
+    SnapshotPolicy snapshotPolicy () const
+      { return _policy; }
+
+protected:
+    // Must be called before anyone can take a snapshot, e.g. from the
+    // constructor of the class deriving from Snapshottable
+    //
+    void setSnapshotPolicy (SnapshotPolicy policy, codeplace const & cp);
+
+protected:
+    // Between lockForWrite() and unlock(), records that an area of the data
+    // changed, so someone holding an older snapshot can update only that
+    // (see SnapshotBase::changedSince()).  For data that isn't an image, the
+    // rectangle can be whatever the data's readers agree on, e.g. a range
+    // of indices as QRect (begin, 0, end - begin, 1).
+    //
+    // Once anything has been marked, a write that doesn't call this at all
+    // counts as having changed everything.  (Marking an empty rectangle says
+    // that it changed nothing.)
+    //
+    void markDirty (QRect const & rect, codeplace const & cp);
+
+  #ifndef THINKERQT_REQUIRE_CODEPLACE
+    //
+    // This will cause any asserts to indicate a failure in snapshottable.h
+    // instead of the offending line in the caller... not as good... see hoist
+    // documentation http://hostilefork.com/hoist/
+    //
+    void markDirty (QRect const & rect)
+      { markDirty(rect, HERE); }
+  #endif
+
+public:
+    int snapshotBuffers () const
+      { return _snapshotBuffers; }
+
+protected:
+    // With one buffer (the default), a write after a snapshot was taken
+    // copies the data into a newly allocated object.  With two or three,
+    // the Snapshottable keeps that many data objects around and writes go
+    // to whichever one no snapshot holds, copied into with copyFrom().
+    // That saves reallocating big data (like images) on every write.  If
+    // they are all held, or the data doesn't implement copyFrom(), it is
+    // plain copy-on-write again.
+    //
+    void setSnapshotBuffers (int buffers, codeplace const & cp);
+
 public:
     // createSnapshotBase returns a pointer to an allocated object
     // due to technical restrictions, but createSnapshot proper returns
@@ -145,9 +331,36 @@ protected:
     virtual void lockForWrite (codeplace const & cp);
     virtual void unlock (codeplace const & cp);
 
+    // Under PublishedSnapshots, makes the current data the version that
+    // snapshots are taken from
+    //
+    virtual void publishVersion () = 0;
+
+    // The data, if writable() was called since lockForWrite().  (Nothing
+    // else can be holding it then, so it is safe to stamp.)
+    //
+    virtual SnapshottableData * writtenData () = 0;
+
+    // Gives the data of a new Snapshottable a version of its own
+    //
+    void startVersions (SnapshottableData & data);
+
+private:
+    void stampVersion (SnapshottableData & data);
+
 protected:
     mutable QReadWriteLock _dLock;
     tracked<bool> _lockedForWrite;
+    SnapshotPolicy _policy;
+    int _snapshotBuffers;
+    bool _written;
+
+private:
+    quint64 _version;  // what the last write was stamped with
+    bool _tracksChanges;  // set once anything is marked dirty
+    bool _marked;  // since lockForWrite()
+    QVector<QRect> _dirty;
+    shared_ptr<SnapshotChanges const> _changes;
 };
 
 
@@ -249,17 +462,39 @@ public:
         SnapshottableBase (),
         _d (QSharedDataPointer<DataType>(
             new DataType (std::forward<Args>(args)...))
-        )
+        ),
+        _published (nullptr),
+        _retired (),
+        _spares ()
     {
+        startVersions(*const_cast<DataType *>(_d.constData()));
     }
 
     virtual ~Snapshottable () override
     {
+        // No one can be taking a snapshot of something being destroyed, so
+        // everything retired can go
+        //
+        release(_published.load(std::memory_order_relaxed));
+        for (QPair<unsigned, DataType *> const & retired : _retired)
+            release(retired.second);
     }
 
 
 public:
     Snapshot createSnapshot () const {
+        if (this->_policy == SnapshottableBase::PublishedSnapshots) {
+            //
+            // The pin keeps the version from being let go of until we have
+            // a reference of our own
+            //
+            SnapshotEpochs::Pin pin;
+            DataType * version = _published.load(std::memory_order_acquire);
+            QSharedDataPointer<DataType> shared (version);
+            Snapshot result (shared);
+            return result;
+        }
+
         QReadLocker lock (&this->_dLock);
         Snapshot result (_d);
         return result;
@@ -291,10 +526,96 @@ protected:
     DataType & writable (codeplace const & cp)
     {
         _lockedForWrite.hopefullyEqualTo(true, cp);
+        this->_written = true;
+
+        // Anyone else holding the data (a snapshot, or the published
+        // version) would make dereferencing _d copy it
+        //
+        if (
+            (this->_snapshotBuffers > 1)
+            and (_d.constData()->ref.loadAcquire() != 1)
+        ){
+            switchBuffers();
+        }
         return *_d;
     }
 
 
+    virtual SnapshottableData * writtenData () override
+    {
+        if (not this->_written)
+            return nullptr;
+        return const_cast<DataType *>(_d.constData());
+    }
+
+
+private:
+    // Only the writer calls this, while _d is shared
+    //
+    void switchBuffers ()
+    {
+        // A spare that only we have a reference to can't be picked up by
+        // anyone else, so it's safe to overwrite
+        //
+        for (int index = 0; index < _spares.size(); ++index) {
+            if (_spares[index].constData()->ref.loadAcquire() != 1)
+                continue;
+
+            DataType * spare = const_cast<DataType *>(
+                _spares[index].constData()
+            );
+            if (not spare->copyFrom(*_d.constData()))
+                return;
+
+            _d.swap(_spares[index]);
+            return;
+        }
+
+        // None are free, so make another buffer if there's room.  (The one
+        // being copied from becomes a spare, for when it's let go of.)
+        //
+        if (_spares.size() < this->_snapshotBuffers - 1)
+            _spares.append(_d);
+    }
+
+
+protected:
+    virtual void publishVersion () override
+    {
+        // Only the writer gets here, so the version it publishes can't
+        // change out from under it
+        //
+        DataType * version = const_cast<DataType *>(_d.constData());
+        if (version == _published.load(std::memory_order_relaxed))
+            return;  // nothing was written since the last time
+
+        version->ref.ref();
+        DataType * old = _published.exchange(
+            version, std::memory_order_acq_rel
+        );
+        if (old != nullptr)
+            _retired.append(qMakePair(SnapshotEpochs::current(), old));
+
+        // Retirees are in order of epoch, so stop at the first that has to
+        // be kept
+        //
+        while (
+            not _retired.isEmpty()
+            and SnapshotEpochs::isReclaimable(_retired.first().first)
+        ){
+            release(_retired.takeFirst().second);
+        }
+    }
+
+
+private:
+    static void release (DataType * version)
+    {
+        if (version != nullptr and not version->ref.deref())
+            delete version;
+    }
+
+
 private:
     // you must initialize this "d" variable in your constructor, and
     // it is where you must put all of your state that you want to
@@ -302,6 +623,18 @@ private:
     // Snapshot is taken
 
     QSharedDataPointer<DataType> _d;
+
+    // Under PublishedSnapshots, the version snapshots are taken from (with
+    // a reference of its own), and the versions it replaced that someone
+    // may still be in the middle of picking up
+    //
+    std::atomic<DataType *> _published;
+    QList<QPair<unsigned, DataType *>> _retired;
+
+    // The data objects other than _d that writes can switch to, if there is
+    // more than one buffer
+    //
+    QList<QSharedDataPointer<DataType>> _spares;
 };
 
 #endif
@@ -87,6 +87,8 @@ class Thinker : public ThinkerBase, private Snapshottable<T>
             ThinkerPresentBase (other)
           { }
 
+        Present & operator= (Present const & other) = default;
+
         virtual ~Present () override
           { }
 
@@ -109,6 +111,74 @@ class Thinker : public ThinkerBase, private Snapshottable<T>
             delete allocatedSnapshot;
             return result;
         }
+
+      public:
+        // Runs the next stage of a pipeline as soon as this thinker has
+        // finished.  The factory is given the final snapshot and is called on
+        // the pool thread this thinker finished on, and the thinker it makes
+        // is queued from there--there's no trip through the manager's event
+        // loop in between.  (If this thinker already finished, that all
+        // happens right away on this thread.)  If it gets canceled instead,
+        // the factory is never called.
+        //
+        // started gets the next thinker's Present on the manager thread,
+        // once its event loop gets to it (the thinker doesn't wait for that).
+        // Call then() on it to add another stage.  The factory may return
+        // nullptr to end the pipeline early.
+        //
+        // Under ThinkerManager::CancelAbandonedThinkers, something has to
+        // keep the Present that started is given, or the next thinker is
+        // canceled right after it is run.
+        //
+        template <class NextType>
+        void then(
+            std::function<unique_ptr<NextType>(Snapshot const &)> factory,
+            std::function<void(typename NextType::Present)> started,
+            int priority
+        ){
+            thenBase(
+                makeNextFactory(factory),
+                makeStartedCallback<NextType>(started),
+                priority
+            );
+        }
+
+        template <class NextType>
+        void then(
+            std::function<unique_ptr<NextType>(Snapshot const &)> factory,
+            std::function<void(typename NextType::Present)> started = nullptr
+        ){
+            thenBase(
+                makeNextFactory(factory),
+                makeStartedCallback<NextType>(started)
+            );
+        }
+
+      private:
+        template <class NextType>
+        static std::function<unique_ptr<ThinkerBase>(ThinkerPresentBase &)>
+        makeNextFactory(
+            std::function<unique_ptr<NextType>(Snapshot const &)> factory
+        ){
+            return [factory](ThinkerPresentBase & base) {
+                Present present (base);
+                return unique_ptr<ThinkerBase> (
+                    factory(present.createSnapshot())
+                );
+            };
+        }
+
+        template <class NextType>
+        static std::function<void(ThinkerPresentBase &)> makeStartedCallback(
+            std::function<void(typename NextType::Present)> started
+        ){
+            if (not started)
+                return nullptr;
+
+            return [started](ThinkerPresentBase & base) {
+                started(typename NextType::Present (base));
+            };
+        }
     };
 
   public:
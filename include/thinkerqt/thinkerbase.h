@@ -22,8 +22,12 @@
 #ifndef THINKERQT_THINKERBASE_H
 #define THINKERQT_THINKERBASE_H
 
+#include <atomic>
+#include <functional>
+
 #include <QObject>
 #include <QSet>
+#include <QString>
 #include <QReadWriteLock>
 
 #include "defs.h"
@@ -35,6 +39,8 @@
 class ThinkerManager;
 class ThinkerRunner;
 class ThinkerPresentWatcherBase;
+struct ThinkerParallelRound;
+struct ThinkerParallelChunk;
 
 //
 // ThinkerBase
@@ -59,6 +65,8 @@ class ThinkerBase : public QObject, virtual public SnapshottableBase
     friend class ThinkerPresentWatcherBase;
     friend class ThinkerPresentBase;
     friend class ThinkerRunner;
+    friend struct ThinkerParallelRound;
+    template <class> friend class ThinkerResults;
 
   private:
     enum class State {
@@ -91,6 +99,39 @@ class ThinkerBase : public QObject, virtual public SnapshottableBase
     void pollForStopException(unsigned long time = 0) const;
   #endif
 
+  public:
+    // Splits the indices in [begin, end) into chunks of grain indices (the
+    // last may be smaller) and calls fn(chunkBegin, chunkEnd) on each.  The
+    // chunks are shared out between this thread and threads from the
+    // manager's pool.  Only call it from the thinker's own thread.
+    //
+    // Inside fn, wasPauseRequested() and pollForStopException() may be
+    // called from any of those threads.  They report a pause or cancel
+    // request to this thinker to all of them.  Chunks may also write with
+    // lockForWrite() and unlock().  A group pause only reaches this thread;
+    // the other chunks carry on through it.
+    //
+    // Returns once every chunk has unwound.  It returns false if a pause or
+    // cancel cut some chunks short (so start() should return the way it
+    // would if wasPauseRequested() had been true).  Nothing is remembered;
+    // calling it again runs every chunk again.  An exception thrown by fn is
+    // rethrown here, on the thinker's thread.
+    //
+    bool parallelFor(
+        int begin,
+        int end,
+        int grain,
+        std::function<void(int, int)> fn
+    );
+
+  private:
+    bool isCurrentThreadChunk() const;
+
+    bool isGroupPaused() const {
+        return (_groupEpoch != nullptr)
+            and (_groupEpoch->load(std::memory_order_relaxed) & 1);
+    }
+
   public:
     virtual void afterThreadAttach();
     virtual void beforeThreadDetach();
@@ -102,7 +143,10 @@ class ThinkerBase : public QObject, virtual public SnapshottableBase
         // thread between the time the Snapshot base class constructor has run
         // and when it is attached to a ThinkerPresent
         //
-        return hopefully(thread() == QThread::currentThread(), cp);
+        return hopefully(
+            (thread() == QThread::currentThread()) or isCurrentThreadChunk(),
+            cp
+        );
     }
 
     // These overrides provide added checking and also signal "progress" when
@@ -112,6 +156,19 @@ class ThinkerBase : public QObject, virtual public SnapshottableBase
     virtual void lockForWrite(codeplace const & cp) override;
     virtual void unlock(codeplace const & cp) override;
 
+  #if OFFER_PROGRESS_API_LIKE_QFUTURE
+    //
+    // Like QFutureInterface's progress reporting.  Setting these doesn't
+    // take any lock, and watchers get a throttled progressChanged() signal
+    // (only if something actually changed).
+    //
+  protected:
+    void setProgressRange(int minimum, int maximum);
+    void setProgress(int value);
+    void setProgress(int value, QString const & text);
+  #endif
+
+  protected:
   #ifndef THINKERQT_REQUIRE_CODEPLACE
     //
     // This will cause the any asserts to indicate a failure in thinker.h
@@ -135,6 +192,12 @@ class ThinkerBase : public QObject, virtual public SnapshottableBase
   signals:
     void done();
 
+    // Emitted after a canceled thinker has unwound and been let go of by its
+    // pool thread.  It comes from that thread, so receivers on other threads
+    // get it through a queued connection.
+    //
+    void canceled();
+
   private:
     bool startMaybeEmitDone() {
         if (start()) {
@@ -166,10 +229,67 @@ class ThinkerBase : public QObject, virtual public SnapshottableBase
     }
 
   private:
-    State _state;
+    // Only meaningful once the runner is gone.  The manager makes it final
+    // on the pool thread just before it clears _runner, and then it is read
+    // from any thread (including by ended callbacks, still on that pool
+    // thread).  A cancel of a finished thinker can still turn Finished into
+    // Canceled, but nothing else changes it after that.
+    //
+    std::atomic<State> _state;
     ThinkerManager & _mgr;
+
+    // While running, points at the runner's flag for whether a pause or
+    // cancel has been requested, so polling for that doesn't have to go
+    // through the manager.  The runner sets the pointer just before start()
+    // and clears it just after, on the thinker's thread.  The flag is stored
+    // by whatever thread makes a request, and is read with relaxed loads by
+    // the thinker and by the chunks of its parallelFor() calls on other
+    // threads.  Those chunks only run while start() does, so they never see
+    // the pointer change; a relaxed load may be stale, which only means the
+    // request is seen on a later poll.
+    //
+    std::atomic<bool> const * _stopRequested;
+
+    // Likewise the epoch of the runner's group if it has one, which is odd
+    // when the group has been paused
+    //
+    std::atomic<unsigned> const * _groupEpoch;
+
+    // The chunk of a parallelFor() that the thinker's own thread (or fiber)
+    // is running, if any.  The other threads running chunks find theirs
+    // through a thread_local instead, since they never move.
+    //
+    ThinkerParallelChunk * _ownChunk;
+    static thread_local ThinkerParallelChunk * _helperChunk;
+
+    // The runner for this thinker, or null once it has finished or been
+    // canceled.  This is how the manager finds a thinker's runner without a
+    // map lookup.  The manager's map owns the runner; anyone reading this
+    // does it through a ThinkerManager::RunnerPin, which counts itself in
+    // _runnerPins first.  After the manager clears the pointer, it waits for
+    // the count to drop to zero before it lets go of the runner.
+    //
+    std::atomic<ThinkerRunner *> _runner;
+    mutable std::atomic<int> _runnerPins;
+
     QReadWriteLock _watchersLock;
     QSet<ThinkerPresentWatcherBase *> _watchers;
+
+    // Gives watchers a throttled written() signal, as unlock() does
+    //
+    void notifyWritten();
+
+  #if OFFER_PROGRESS_API_LIKE_QFUTURE
+    void notifyProgress();
+
+    std::atomic<int> _progressMinimum;
+    std::atomic<int> _progressMaximum;
+    std::atomic<int> _progressValue;
+
+    // Only accessed with std::atomic_load() and std::atomic_store()
+    //
+    shared_ptr<QString const> _progressText;
+  #endif
 };
 
 #endif // THINKERBASE_H
@@ -0,0 +1,300 @@
+//
+// thinkercache.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERCACHE_H
+#define THINKERQT_THINKERCACHE_H
+
+#include <functional>
+
+#include <QObject>
+#include <QCache>
+#include <QMap>
+#include <QHash>
+
+#include "defs.h"
+#include "thinker.h"
+#include "thinkermanager.h"
+#include "thinkerinterest.h"
+
+struct ThinkerCacheLink;
+
+
+//
+// ThinkerCacheBase
+//
+// A ThinkerCache remembers the results of thinkers by the parameters they
+// were run with, so asking for the same thing again doesn't redo the work.
+// run() is given a key along with a factory for the thinker.  If a thinker
+// with an equal key has finished and is still in the cache, its Present is
+// handed back--already finished, with its final data--and nothing goes near
+// the thread pool.  Otherwise the thinker is run as usual, and remembered
+// once it finishes.
+//
+// The cache is a QCache, so it is LRU and bounded by a total cost.  Costs
+// are meant to be in bytes: by default each entry costs the size of the
+// thinker's DataType, but anything holding on to big implicitly shared data
+// (like an image) should supply a function that measures it.
+//
+// A request for a key whose thinker is still running joins that thinker
+// instead of starting another.  Everyone who asked gets a Present sharing
+// it (see ThinkerSharing), and it is only canceled once all of them have
+// canceled their Presents or let go of them.  Canceled thinkers are
+// forgotten, and never cached.  Presents handed out for cached thinkers are
+// parties to the sharing too, so canceling one can't mark the result as
+// canceled for everyone else.
+//
+// A cache is used from the thread it lives on, which needs an event loop.
+//
+// (The base class is needed because moc can't handle templated QObjects:
+// http://doc.trolltech.com/qq/qq15-academic.html)
+//
+
+class ThinkerCacheBase : public QObject
+{
+    Q_OBJECT
+
+  public:
+  #ifdef THINKERQT_EXPLICIT_MANAGER
+    explicit ThinkerCacheBase (ThinkerManager & mgr, QObject * parent = nullptr);
+  #else
+    explicit ThinkerCacheBase (QObject * parent = nullptr);
+  #endif
+
+    ~ThinkerCacheBase () override;
+
+  public:
+    ThinkerManager & getManager() const
+      { return _mgr; }
+
+  protected:
+    // Calls thinkerEnded() on this thread once the thinker has finished or
+    // been canceled for good, so the Present says which it was.  (Not if the
+    // cache is gone by then.)
+    //
+    void watch(ThinkerPresentBase & present);
+
+    virtual void thinkerEnded(ThinkerBase const * thinker) = 0;
+
+  private:
+    ThinkerManager & _mgr;
+
+    // What the pool threads the thinkers end on reach us through
+    //
+    shared_ptr<ThinkerCacheLink> _link;
+};
+
+
+//
+// ThinkerCache
+//
+// Key needs an operator== and a qHash() overload, as for QHash, and must be
+// default constructible.
+//
+
+template <class ThinkerType, class Key>
+class ThinkerCache : public ThinkerCacheBase
+{
+  public:
+    typedef typename ThinkerType::Present Present;
+    typedef typename ThinkerType::Snapshot Snapshot;
+    typedef typename ThinkerType::DataType DataType;
+
+    typedef std::function<int(DataType const &)> CostFunction;
+
+    static int defaultCost(DataType const &)
+      { return sizeof(DataType); }
+
+  public:
+  #ifdef THINKERQT_EXPLICIT_MANAGER
+    ThinkerCache (
+        ThinkerManager & mgr,
+        int maxBytes,
+        CostFunction cost = &ThinkerCache::defaultCost,
+        QObject * parent = nullptr
+    ) :
+        ThinkerCacheBase (mgr, parent),
+        _cache (maxBytes),
+        _cost (cost),
+        _pending ()
+      { }
+  #else
+    explicit ThinkerCache (
+        int maxBytes,
+        CostFunction cost = &ThinkerCache::defaultCost,
+        QObject * parent = nullptr
+    ) :
+        ThinkerCacheBase (parent),
+        _cache (maxBytes),
+        _cost (cost),
+        _pending ()
+      { }
+  #endif
+
+  public:
+    Present run(
+        Key const & key,
+        std::function<unique_ptr<ThinkerType>()> factory,
+        int priority,
+        codeplace const & cp
+    ){
+        hopefully(QThread::currentThread() == thread(), cp);
+
+        // A new party to the sharing, whose cancel() only withdraws its own
+        // interest (which does nothing to a finished thinker)
+        //
+        if (Cached * cached = _cache.object(key)) {
+            ThinkerPresentBase joined = cached->sharing->join();
+            return Present (joined);
+        }
+
+        if (_pendingKeys.contains(key)) {
+            Pending & pending = _pending[_pendingKeys.value(key)];
+            if (not pending.present.isCanceled()) {
+                ThinkerPresentBase joined = pending.sharing->join();
+                return Present (joined);
+            }
+
+            // Canceled, but we haven't heard yet; it's as good as gone
+            //
+            forget(_pendingKeys.value(key));
+        }
+
+        // The manager will have made the thinker shared already if its
+        // policy is to cancel abandoned thinkers
+        //
+        Present started = getManager().run(factory(), priority, cp);
+        shared_ptr<ThinkerSharing> sharing = started.getSharing();
+        if (not sharing)
+            sharing = make_shared<ThinkerSharing>(started);
+
+        // What we keep in _pending isn't a party to the sharing, or the
+        // thinker could never be abandoned
+        //
+        ThinkerPresentBase observer = sharing->observe();
+        ThinkerPresentBase joined = sharing->join();
+
+        Pending pending;
+        pending.key = key;
+        pending.present = Present (observer);
+        pending.sharing = sharing;
+
+        ThinkerBase const * thinker =
+            &getManager().getThinkerBase(pending.present);
+        _pending.insert(thinker, pending);
+        _pendingKeys.insert(key, thinker);
+        watch(pending.present);
+
+        return Present (joined);
+    }
+
+    Present run(
+        Key const & key,
+        std::function<unique_ptr<ThinkerType>()> factory,
+        codeplace const & cp
+    ){
+        return run(key, factory, ThinkerManager::NormalPriority, cp);
+    }
+
+  #ifndef THINKERQT_REQUIRE_CODEPLACE
+    //
+    // This will cause any asserts to indicate a failure in thinkercache.h
+    // instead of the offending line in the caller... not as good... see hoist
+    // documentation http://hostilefork.com/hoist/
+    //
+    Present run(
+        Key const & key,
+        std::function<unique_ptr<ThinkerType>()> factory,
+        int priority = ThinkerManager::NormalPriority
+    ){
+        return run(key, factory, priority, HERE);
+    }
+  #endif
+
+    bool contains(Key const & key) const
+      { return _cache.contains(key); }
+
+    void remove(Key const & key)
+      { _cache.remove(key); }
+
+    void clear()
+      { _cache.clear(); }
+
+    void setMaxBytes(int maxBytes)
+      { _cache.setMaxCost(maxBytes); }
+
+    int maxBytes() const
+      { return _cache.maxCost(); }
+
+    int totalBytes() const
+      { return _cache.totalCost(); }
+
+  protected:
+    void thinkerEnded(ThinkerBase const * thinker) override {
+        if (not _pending.contains(thinker))
+            return;
+
+        Pending pending = _pending.value(thinker);
+        forget(thinker);
+
+        if (pending.present.isCanceled())
+            return;
+
+        int cost = _cost(pending.present.createSnapshot().data());
+
+        Cached * cached = new Cached;
+        cached->present = pending.present;
+        cached->sharing = pending.sharing;
+
+        // QCache deletes the object itself if it's too big to keep at all
+        //
+        _cache.insert(pending.key, cached, cost);
+    }
+
+  private:
+    void forget(ThinkerBase const * thinker) {
+        Key key = _pending.value(thinker).key;
+        _pending.remove(thinker);
+        _pendingKeys.remove(key);
+    }
+
+  private:
+    // The Present kept is only an observer of the sharing, like the one in
+    // Pending
+    //
+    struct Cached {
+        Present present;
+        shared_ptr<ThinkerSharing> sharing;
+    };
+    QCache<Key, Cached> _cache;
+    CostFunction _cost;
+
+    // Thinkers that have been run but haven't finished yet
+    //
+    struct Pending {
+        Key key;
+        Present present;
+        shared_ptr<ThinkerSharing> sharing;
+    };
+    QMap<ThinkerBase const *, Pending> _pending;
+    QHash<Key, ThinkerBase const *> _pendingKeys;
+};
+
+#endif
@@ -0,0 +1,107 @@
+//
+// thinkerexecutor.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKEREXECUTOR_H
+#define THINKERQT_THINKEREXECUTOR_H
+
+#include <QRunnable>
+#include <QThreadPool>
+
+#include "defs.h"
+
+
+//
+// ThinkerExecutor
+//
+// The ThinkerManager does not run thinkers itself, it hands a QRunnable for
+// each one to an executor.  The interface is deliberately the subset of
+// QThreadPool that the manager actually uses, so that the default executor
+// is just a thin wrapper around a private QThreadPool.  Other scheduling
+// strategies can be plugged in with ThinkerManager::setExecutor().
+//
+// Executors must honor QRunnable::autoDelete(), reading it before run() is
+// called (as QThreadPool does).
+//
+
+class ThinkerExecutor
+{
+  public:
+    virtual ~ThinkerExecutor ();
+
+  public:
+    // Queue the runnable; an executor is free to ignore the priority
+    //
+    virtual void start(QRunnable * runnable, int priority) = 0;
+
+    // Remove a runnable that has not been picked up by a thread yet, giving
+    // ownership back to the caller.  Executors that can't do this return
+    // false, which just means a change in priority won't reorder anything.
+    //
+    virtual bool tryTake(QRunnable * runnable) = 0;
+
+    virtual bool waitForDone(int milliseconds = -1) = 0;
+
+  public:
+    virtual void setMaxThreadCount(int maxThreadCount) = 0;
+    virtual int maxThreadCount() const = 0;
+
+    virtual void setStackSize(uint stackSize) = 0;
+    virtual uint stackSize() const = 0;
+
+    virtual void setExpiryTimeout(int milliseconds) = 0;
+    virtual int expiryTimeout() const = 0;
+};
+
+
+//
+// ThinkerPoolExecutor
+//
+// The default executor.  QThreadPool keeps a single priority-sorted queue
+// guarded by one mutex, which is fine unless very many short thinkers are
+// being dispatched at once (see WorkStealingExecutor for that case).
+//
+
+class ThinkerPoolExecutor : public ThinkerExecutor
+{
+  public:
+    ThinkerPoolExecutor ();
+    ~ThinkerPoolExecutor () override;
+
+  public:
+    void start(QRunnable * runnable, int priority) override;
+    bool tryTake(QRunnable * runnable) override;
+    bool waitForDone(int milliseconds = -1) override;
+
+  public:
+    void setMaxThreadCount(int maxThreadCount) override;
+    int maxThreadCount() const override;
+
+    void setStackSize(uint stackSize) override;
+    uint stackSize() const override;
+
+    void setExpiryTimeout(int milliseconds) override;
+    int expiryTimeout() const override;
+
+  private:
+    QThreadPool _pool;
+};
+
+#endif
@@ -0,0 +1,85 @@
+//
+// thinkerfiber.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERFIBER_H
+#define THINKERQT_THINKERFIBER_H
+
+#include <QtGlobal>
+
+#include "defs.h"
+
+#if THINKERQT_USE_FIBERS
+
+#include <functional>
+#include <ucontext.h>
+
+//
+// ThinkerFiber
+//
+// A stackful coroutine built on POSIX ucontext.  A pool thread calls
+// resume() to run the fiber until it either returns or calls suspend();
+// the next resume() may come from a completely different thread.  This is
+// what lets a paused thinker give its pool thread back while keeping its
+// whole call stack (including the middle of start()) intact.
+//
+// Code running on a fiber must not cache anything thread-specific across a
+// suspend(), because it may wake up on another OS thread.  Thinker-Qt
+// detaches and reattaches the thinker's QObject thread affinity around each
+// suspension, but anything the thinker does with thread_local variables of
+// its own is its own business.
+//
+
+class ThinkerFiber
+{
+  public:
+    ThinkerFiber (std::function<void()> body, std::size_t stackSize);
+    ThinkerFiber (ThinkerFiber const & other) = delete;
+    ~ThinkerFiber ();
+
+  public:
+    // Only from outside the fiber; returns when the fiber suspends or ends
+    //
+    void resume();
+
+    // Only from inside the fiber
+    //
+    void suspend();
+
+    bool isFinished() const
+      { return _finished; }
+
+    static ThinkerFiber * current();
+
+  private:
+    static void trampoline(int high, int low);
+
+  private:
+    std::function<void()> _body;
+    std::size_t _stackSize;
+    char * _stack;
+    ucontext_t _context;  // the fiber's own registers and stack
+    ucontext_t _caller;  // whichever thread last called resume()
+    bool _finished;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,265 @@
+//
+// thinkergraph.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERGRAPH_H
+#define THINKERQT_THINKERGRAPH_H
+
+#include <functional>
+
+#include <QList>
+#include <QMap>
+
+#include "defs.h"
+#include "thinker.h"
+#include "thinkermanager.h"
+
+struct ThinkerGraphControl;
+
+
+//
+// ThinkerGraphNode
+//
+// Handles for the nodes of a ThinkerGraph.  They remember what type of
+// thinker the node makes, so its snapshots and Present can be asked for
+// with the right type.
+//
+
+class ThinkerGraphNodeBase
+{
+  public:
+    ThinkerGraphNodeBase () :
+        _index (-1)
+      { }
+
+    bool isNull() const
+      { return _index == -1; }
+
+  protected:
+    friend class ThinkerGraph;
+    friend class ThinkerGraphInputs;
+
+    explicit ThinkerGraphNodeBase (int index) :
+        _index (index)
+      { }
+
+    int _index;
+};
+
+
+template <class ThinkerType>
+class ThinkerGraphNode : public ThinkerGraphNodeBase
+{
+  public:
+    ThinkerGraphNode () :
+        ThinkerGraphNodeBase ()
+      { }
+
+  private:
+    friend class ThinkerGraph;
+
+    explicit ThinkerGraphNode (int index) :
+        ThinkerGraphNodeBase (index)
+      { }
+};
+
+
+//
+// ThinkerGraphInputs
+//
+// What a node's factory is given: the final snapshots of the nodes it takes
+// as inputs.  (Those nodes all finished before the factory was called.)
+//
+
+class ThinkerGraphInputs
+{
+  public:
+    template <class ThinkerType>
+    typename ThinkerType::Snapshot snapshot(
+        ThinkerGraphNode<ThinkerType> const & input
+    ) const {
+        hopefully(_snapshots.contains(input._index), HERE);  // not an input
+
+        SnapshotBase * base = _snapshots.value(input._index).get();
+        auto ptr = dynamic_cast<typename ThinkerType::Snapshot *>(base);
+        hopefully(ptr != nullptr, HERE);
+
+        return *ptr;
+    }
+
+  private:
+    friend class ThinkerGraph;
+
+    QMap<int, shared_ptr<SnapshotBase>> _snapshots;
+};
+
+
+//
+// ThinkerGraph
+//
+// Work that splits into stages (tiling, then filtering the tiles, then
+// reducing them) is a dependency graph of thinkers.  Each node of a
+// ThinkerGraph is a factory for a thinker, and lists the nodes it takes as
+// inputs.  Once start() is called, each node is run as soon as all of its
+// inputs have finished, and its factory gets their final snapshots.  That
+// happens on the pool thread the last input finished on (see
+// ThinkerPresentBase::whenEnded()), so no stage waits on the manager's
+// event loop.
+//
+// A node can only take inputs that were added before it, so the graph can't
+// have a cycle.  If a node is canceled, nothing downstream of it ever runs.
+// Neither does anything downstream of a node whose factory returned nullptr.
+//
+// Of the nodes that are ready together, the ones on the longest chain still
+// to go get a higher priority.  This is the critical path.  Each node has a
+// cost (in any unit, as long as the units match) to measure chains by, and
+// the priorities count up from the one given to start().  Ranks are used
+// rather than the costs themselves, so a graph of n nodes uses at most n
+// priorities.
+//
+// Like a ThinkerGroup, a graph that goes away doesn't cancel or wait for
+// anything.  Nodes still waiting on their inputs run when those finish.
+//
+
+class ThinkerGraph
+{
+  public:
+    typedef std::function<unique_ptr<ThinkerBase>(ThinkerGraphInputs const &)>
+        FactoryBase;
+
+  public:
+  #ifdef THINKERQT_EXPLICIT_MANAGER
+    explicit ThinkerGraph (ThinkerManager & mgr);
+  #else
+    ThinkerGraph ();
+  #endif
+
+    ThinkerGraph (ThinkerGraph const & other) = delete;
+
+    ~ThinkerGraph ();
+
+  public:
+    ThinkerManager & getManager() const
+      { return _mgr; }
+
+    // Nodes can only be added before start()
+    //
+    template <class ThinkerType>
+    ThinkerGraphNode<ThinkerType> add(
+        std::function<unique_ptr<ThinkerType>(ThinkerGraphInputs const &)>
+            factory,
+        QList<ThinkerGraphNodeBase> const & inputs,
+        int cost,
+        codeplace const & cp
+    ){
+        FactoryBase factoryBase = [factory](ThinkerGraphInputs const & in) {
+            return unique_ptr<ThinkerBase> (factory(in));
+        };
+        return ThinkerGraphNode<ThinkerType> (
+            addBase(factoryBase, inputs, cost, cp)
+        );
+    }
+
+    // Empty until the node has been run.  (Canceling a node that has been
+    // run is done through its Present.)  Each call makes a new Present on
+    // the calling thread, and it isn't a party to any sharing, so letting
+    // go of it never cancels the node.
+    //
+    template <class ThinkerType>
+    typename ThinkerType::Present present(
+        ThinkerGraphNode<ThinkerType> const & node
+    ) const {
+        ThinkerPresentBase base = presentBase(node);
+        if (base == ThinkerPresentBase ())
+            return typename ThinkerType::Present ();
+        return typename ThinkerType::Present (base);
+    }
+
+    ThinkerPresentBase presentBase(ThinkerGraphNodeBase const & node) const;
+
+  public:
+    void start(int priority, codeplace const & cp);
+
+    // Cancels (without waiting) every node that is running, and makes sure
+    // the ones that haven't been run never are
+    //
+    void cancel(codeplace const & cp);
+
+    // True once every node has either finished or been canceled (or will
+    // never run)
+    //
+    bool isFinished() const;
+
+    void waitForFinished(codeplace const & cp);
+
+  #ifndef THINKERQT_REQUIRE_CODEPLACE
+    //
+    // This will cause any asserts to indicate a failure in thinkergraph.h
+    // instead of the offending line in the caller... not as good... see hoist
+    // documentation http://hostilefork.com/hoist/
+    //
+    template <class ThinkerType>
+    ThinkerGraphNode<ThinkerType> add(
+        std::function<unique_ptr<ThinkerType>(ThinkerGraphInputs const &)>
+            factory,
+        QList<ThinkerGraphNodeBase> const & inputs = {},
+        int cost = 1
+    ){
+        return add(factory, inputs, cost, HERE);
+    }
+
+    void start(int priority = ThinkerManager::NormalPriority)
+      { start(priority, HERE); }
+
+    void cancel()
+      { cancel(HERE); }
+
+    void waitForFinished()
+      { waitForFinished(HERE); }
+  #endif
+
+  private:
+    int addBase(
+        FactoryBase factory,
+        QList<ThinkerGraphNodeBase> const & inputs,
+        int cost,
+        codeplace const & cp
+    );
+
+    // These run on whatever thread noticed the nodes were ready (or over)
+    //
+    static void dispatch(
+        ThinkerManager & mgr,
+        shared_ptr<ThinkerGraphControl> control,
+        QList<int> ready
+    );
+    static void nodeEnded(
+        ThinkerManager & mgr,
+        shared_ptr<ThinkerGraphControl> control,
+        int index,
+        bool canceled
+    );
+
+  private:
+    ThinkerManager & _mgr;
+    shared_ptr<ThinkerGraphControl> _control;
+};
+
+#endif
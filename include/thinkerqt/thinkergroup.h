@@ -0,0 +1,206 @@
+//
+// thinkergroup.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERGROUP_H
+#define THINKERQT_THINKERGROUP_H
+
+#include <atomic>
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QMap>
+#include <QList>
+
+#include "defs.h"
+#include "thinkermanager.h"
+
+class ThinkerRunner;
+
+
+//
+// ThinkerGroupControl
+//
+// The part of a ThinkerGroup that its runners point at.  It is shared, so
+// thinkers that are still running when the group goes away don't have to
+// care.
+//
+struct ThinkerGroupControl {
+    ThinkerGroupControl ();
+    ~ThinkerGroupControl ();
+
+    // Odd while the group is paused.  It goes up by one on every pause and
+    // every resume, so a member that slept through a resume followed by
+    // another pause can still tell it was meant to wake up in between.
+    // Only changed with the mutex held; thinkers poll it without.
+    //
+    std::atomic<unsigned> epoch;
+
+    // Guards everything below, and the wait condition is signaled whenever
+    // any of it (or the epoch) changes, or a member is paused or canceled
+    //
+    QMutex mutex;
+    QWaitCondition changed;
+
+    // How many members are executing thinker code right now.  Members that
+    // are queued, paused (individually or by the group) or done don't count.
+    //
+    int running;
+
+    QMap<ThinkerBase const *, shared_ptr<ThinkerRunner>> runners;
+};
+
+
+//
+// ThinkerGroup
+//
+// ThinkerManager::ensureThinkersPaused() stops every thinker in the program,
+// which is rarely what one subsystem wants.  Thinkers run through a group
+// instead can be paused, resumed, canceled and waited on as a unit without
+// disturbing anyone else's.
+//
+// Pausing a group doesn't visit its members.  It just flips the group's
+// epoch to odd, which the members see the next time they poll
+// wasPauseRequested().  That call then blocks until the group is resumed
+// (or the member is canceled, or paused on its own) and returns false, so
+// thinkers don't need a resume() implementation to be paused by a group.
+// Members that haven't started yet block in the same way before start().
+// Either way they hold on to their pool thread while they wait, fibers or
+// no fibers.
+//
+// A member that is waiting on its group still looks like it's running to
+// its Present; ask the group if you want to know whether it is paused.
+//
+
+class ThinkerGroup
+{
+  public:
+  #ifdef THINKERQT_EXPLICIT_MANAGER
+    explicit ThinkerGroup (ThinkerManager & mgr);
+  #else
+    ThinkerGroup ();
+  #endif
+
+    ThinkerGroup (ThinkerGroup const & other) = delete;
+
+    // Resumes the group if it was left paused, but does not cancel or wait
+    // for its members
+    //
+    ~ThinkerGroup ();
+
+  public:
+    ThinkerManager & getManager() const
+      { return _mgr; }
+
+    template <class ThinkerType>
+    typename ThinkerType::Present run(
+        unique_ptr<ThinkerType> holder,
+        int priority,
+        codeplace const & cp
+    ){
+        return _mgr.run(std::move(holder), *this, priority, cp);
+    }
+
+    template <class ThinkerType>
+    typename ThinkerType::Present run(
+        unique_ptr<ThinkerType> holder,
+        codeplace const & cp
+    ){
+        return run(std::move(holder), ThinkerManager::NormalPriority, cp);
+    }
+
+  public:
+    // These return right away; members notice on their next poll
+    //
+    void pause(codeplace const & cp);
+    void resume(codeplace const & cp);
+    bool isPaused() const;
+
+    // Blocks until no member is executing thinker code
+    //
+    void waitForPause(codeplace const & cp);
+
+    void cancel(codeplace const & cp);
+
+    // The group may not be paused, nor may any member individually
+    //
+    void waitForFinished(codeplace const & cp);
+
+  #ifndef THINKERQT_REQUIRE_CODEPLACE
+    //
+    // This will cause any asserts to indicate a failure in thinkergroup.h
+    // instead of the offending line in the caller... not as good... see hoist
+    // documentation http://hostilefork.com/hoist/
+    //
+    template <class ThinkerType>
+    typename ThinkerType::Present run(unique_ptr<ThinkerType>&& thinker)
+      { return run(std::move(thinker), HERE); }
+
+    template <class ThinkerType>
+    typename ThinkerType::Present run(
+        unique_ptr<ThinkerType>&& thinker,
+        int priority
+    )
+      { return run(std::move(thinker), priority, HERE); }
+
+    void pause()
+      { pause(HERE); }
+
+    void resume()
+      { resume(HERE); }
+
+    void waitForPause()
+      { waitForPause(HERE); }
+
+    void cancel()
+      { cancel(HERE); }
+
+    void waitForFinished()
+      { waitForFinished(HERE); }
+  #endif
+
+  private:
+    friend class ThinkerManager;
+
+    QList<shared_ptr<ThinkerRunner>> copyRunners();
+
+  private:
+    ThinkerManager & _mgr;
+    shared_ptr<ThinkerGroupControl> _control;
+};
+
+
+#ifndef THINKERQT_EXPLICIT_MANAGER
+    namespace ThinkerQt {
+        template <class ThinkerType, class... Args>
+        typename ThinkerType::Present runInGroup(
+            ThinkerGroup & group,
+            Args&&... args
+        ){
+            return group.run(
+                unique_ptr<ThinkerType>(
+                    new ThinkerType (std::forward<Args>(args)...)
+                )
+            );
+        }
+    }
+#endif
+
+#endif
@@ -0,0 +1,112 @@
+//
+// thinkerinterest.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERINTEREST_H
+#define THINKERQT_THINKERINTEREST_H
+
+#include <atomic>
+
+#include <QtGlobal>
+
+#include "defs.h"
+
+class ThinkerBase;
+class ThinkerPresentBase;
+
+
+//
+// ThinkerSharing
+//
+// Normally a Present's cancel() cancels its thinker, no matter who else
+// might be holding a Present for it.  When several unrelated parties are
+// handed Presents for one thinker (such as when ThinkerCache joins
+// identical requests that are in flight) that isn't what any of them
+// want.  So each party gets a ThinkerInterest instead, and the thinker is
+// only canceled once every interest has been withdrawn.
+//
+// An interest is withdrawn when its Present is canceled, or when the last
+// copy of that Present goes away.  Withdrawing doesn't change what the
+// Present reports about the thinker, which others may still be using.
+//
+// The same mechanism gives ThinkerManager its CancelWhenAbandoned policy,
+// where every thinker is shared--by one party, to begin with.
+//
+
+class ThinkerSharing : public std::enable_shared_from_this<ThinkerSharing>
+{
+  public:
+    explicit ThinkerSharing (ThinkerPresentBase const & present);
+    ThinkerSharing (ThinkerSharing const & other) = delete;
+    ~ThinkerSharing ();
+
+  public:
+    int interestCount() const
+      { return _interests.load(); }
+
+    // A Present for the thinker that is a new party to the sharing
+    //
+    ThinkerPresentBase join();
+
+    // A Present for the thinker that isn't a party at all (for keeping
+    // track of the thinker without keeping it from being abandoned)
+    //
+    ThinkerPresentBase observe() const;
+
+  private:
+    friend class ThinkerInterest;
+
+    void addInterest();
+    void removeInterest();
+
+  private:
+    shared_ptr<ThinkerBase> _holder;
+    std::atomic<int> _interests;
+};
+
+
+//
+// ThinkerInterest
+//
+// One party's stake in a shared thinker.  A Present holds it by shared_ptr,
+// so all the copies made of that Present count as one party.
+//
+
+class ThinkerInterest
+{
+  public:
+    explicit ThinkerInterest (shared_ptr<ThinkerSharing> sharing);
+    ThinkerInterest (ThinkerInterest const & other) = delete;
+    ~ThinkerInterest ();
+
+  public:
+    shared_ptr<ThinkerSharing> getSharing() const
+      { return _sharing; }
+
+    // Only the first call has any effect
+    //
+    void withdraw();
+
+  private:
+    shared_ptr<ThinkerSharing> _sharing;
+    std::atomic<bool> _withdrawn;
+};
+
+#endif
@@ -22,18 +22,24 @@
 #ifndef THINKERQT_THINKERMANAGER_H
 #define THINKERQT_THINKERMANAGER_H
 
+#include <atomic>
+#include <functional>
+
 #include <QThread>
 #include <QMutex>
-#include <QWaitCondition>
 #include <QMap>
 
 #include "defs.h"
 #include "thinkerbase.h"
 #include "thinkerpresent.h"
+#include "thinkerexecutor.h"
 
 class ThinkerRunner;
+class ThinkerRunnerProxy;
 class ThinkerRunnerHelper;
 class ThinkerRunnerKeepalive;
+class ThinkerGroup;
+struct ThinkerGroupControl;
 
 
 //
@@ -45,6 +51,14 @@ class ThinkerRunnerKeepalive;
 // You must make all your requests of the ThinkerManager on the thread
 // affinity of the ThinkerManager.
 //
+// Each manager runs its thinkers on an executor of its own, instead of
+// sharing QThreadPool::globalInstance() with QtConcurrent and whatever other
+// libraries are in the process.  By default that is a private QThreadPool,
+// but any ThinkerExecutor (such as WorkStealingExecutor) can be swapped in
+// before the first thinker is run.  The executor can be sized and tuned
+// through the setters below; changes to the stack size only apply to
+// threads that are created after the call.
+//
 
 class ThinkerManager : public QObject {
     Q_OBJECT
@@ -57,37 +71,123 @@ class ThinkerManager : public QObject {
   private:
     // only one point of creation of the manager
     // all Thinkers assume it's the one you meant (mirrors QtConcurrent)
-    explicit ThinkerManager ();
+    explicit ThinkerManager (int maxThreadCount = -1);
 
   public:
     static ThinkerManager & getGlobalManager();
 #else
   public:
     // many potential managers created
-    explicit ThinkerManager();
+    explicit ThinkerManager (int maxThreadCount = -1);
 #endif
 
+  public:
+    // The manager takes ownership.  Must be called before any thinkers are
+    // run, or after all of them have finished or been canceled.  Whatever
+    // was set through the calls below (or the constructor's thread count)
+    // is applied to the new executor; anything that wasn't is left as the
+    // executor has it.
+    //
+    void setExecutor(unique_ptr<ThinkerExecutor> executor);
+    ThinkerExecutor & getExecutor();
+
+    // A negative (or zero) count means QThread::idealThreadCount()
+    //
+    void setMaxThreadCount(int maxThreadCount);
+    int maxThreadCount() const;
+
+    void setStackSize(uint stackSize);
+    uint stackSize() const;
+
+    void setExpiryTimeout(int milliseconds);
+    int expiryTimeout() const;
+
+    // Pool threads are given this as their QThread::objectName() when they
+    // pick up their first thinker, so they can be told apart in debugging
+    // output.  Threads that have already been named keep their old name, so
+    // set this before running anything.
+    //
+    void setThreadName(QString const & name);
+    QString threadName() const;
+
+  #if THINKERQT_USE_FIBERS
+    // When nonzero, thinkers run afterward each get a fiber with a stack of
+    // this many bytes.  A paused thinker then suspends inside its call to
+    // wasPauseRequested() and frees its pool thread, instead of holding on to
+    // it until resumed.  Zero (the default) runs thinkers directly on the
+    // pool threads.
+    //
+    void setFiberStackSize(std::size_t stackSize);
+    std::size_t fiberStackSize() const;
+  #endif
+
+  public:
+    // Like a QFuture, a thinker normally runs to completion even if nobody
+    // is left holding a Present (or a watcher) for it.  With
+    // CancelAbandonedThinkers, thinkers run afterward are canceled--without
+    // waiting--once the last of those is gone, and the thinker (with the
+    // data it was writing) is freed as soon as it unwinds.
+    //
+    // The manager's own hold on a thinker doesn't count, and neither does
+    // anything else internal.  But a Present captured in a lambda or kept in
+    // a container does, so those keep the thinker alive.  The last Present
+    // must not go away on a thinker thread.
+    //
+    enum AbandonPolicy {
+        KeepAbandonedThinkers,
+        CancelAbandonedThinkers
+    };
+
+    void setAbandonPolicy(AbandonPolicy policy);
+    AbandonPolicy abandonPolicy() const;
+
+  public:
+    bool isThreadThinker(QThread const & thread);
+    bool isCurrentThreadThinker();
+
+    // These are inline and written entirely as the condition of hopefully(),
+    // so that they vanish along with it in unchecked builds
+    //
   public:
     bool hopefullyThreadIsManager(
         QThread const & thread,
         codeplace const & cp
-    );
-    bool hopefullyCurrentThreadIsManager(codeplace const & cp);
+    ){
+        return hopefully(&thread == this->thread(), cp);
+    }
+
+    bool hopefullyCurrentThreadIsManager(codeplace const & cp)
+      { return hopefully(QThread::currentThread() == this->thread(), cp); }
+
     bool hopefullyThreadIsNotManager(
         QThread const & thread,
         codeplace const & cp
-    );
-    bool hopefullyCurrentThreadIsNotManager(codeplace const & cp);
+    ){
+        return hopefully(&thread != this->thread(), cp);
+    }
+
+    bool hopefullyCurrentThreadIsNotManager(codeplace const & cp)
+      { return hopefully(QThread::currentThread() != this->thread(), cp); }
+
     bool hopefullyThreadIsNotThinker(
         QThread const & thread,
         codeplace const & cp
-    );
-    bool hopefullyCurrentThreadIsNotThinker(codeplace const & cp);
+    ){
+        return hopefully(not isThreadThinker(thread), cp);
+    }
+
+    bool hopefullyCurrentThreadIsNotThinker(codeplace const & cp)
+      { return hopefully(not isCurrentThreadThinker(), cp); }
+
     bool hopefullyThreadIsThinker(
         QThread const & thread,
         codeplace const & cp
-    );
-    bool hopefullyCurrentThreadIsThinker(codeplace const & cp);
+    ){
+        return hopefully(isThreadThinker(thread), cp);
+    }
+
+    bool hopefullyCurrentThreadIsThinker(codeplace const & cp)
+      { return hopefully(isCurrentThreadThinker(), cp); }
 
   public:
     ThinkerBase const * getThinkerForThreadMaybeNull(QThread const & thread);
@@ -98,17 +198,6 @@ class ThinkerManager : public QObject {
     ThinkerBase const & getThinkerBase(ThinkerPresentBase const & present)
       { return present.getThinkerBase(); }
 
-    // It used to be that Thinkers (QObjects) were created on the Manager
-    // thread and then pushed to a thread of their own during the Run.  Since
-    // Run now queues, that push is deferred.  We only know which thread the
-    // ThreadPool will put a Thinker onto when ThreadRunner::run() happens,
-    // so we make a moveThinkerToThread request from that
-  signals:
-    void pushToThreadMayBeNeeded();
-
-  private slots:
-    void doThreadPushesIfNecessary();
-
   signals:
     void anyThinkerWritten();
   protected:
@@ -119,12 +208,51 @@ class ThinkerManager : public QObject {
   private:
     void createRunnerForThinker(
         shared_ptr<ThinkerBase> holder,
+        int priority,
+        ThinkerGroup * group,  // may be null
         codeplace const & cp
     );
 
-  public:  // https://github.com/hostilefork/thinker-qt/issues/5
+    // Thinkers started by ThinkerPresentBase::then() skip the trip through
+    // the manager thread.  They're run from the pool thread the thinker
+    // before them finished on (or from whoever called then(), if that
+    // thinker had already finished).  No Present is made for them here, as
+    // it would have to be destroyed on this thread; the caller makes one on
+    // the thread that will keep it (and applies the abandon policy there).
+    //
+    shared_ptr<ThinkerBase> runContinuation(
+        unique_ptr<ThinkerBase> holder,
+        int priority,
+        codeplace const & cp
+    );
+
+    void startRunner(
+        shared_ptr<ThinkerBase> holder,
+        int priority,
+        shared_ptr<ThinkerGroupControl> group,  // may be null
+        codeplace const & cp
+    );
+
+    // Makes the Present for a thinker that was just run the first party to
+    // share it (see ThinkerSharing), if the policy calls for that
+    //
+    void applyAbandonPolicy(ThinkerPresentBase & present);
+
+  public:
+    // Thinkers with a higher priority are handed to pool threads before
+    // those with a lower one; equal priorities run in the order queued.  The
+    // priority of a thinker that has not started yet can be changed later
+    // with ThinkerPresentBase::setPriority().
+    //
+    enum Priority {
+        LowPriority = -1,
+        NormalPriority = 0,
+        HighPriority = 1
+    };
+
+  private:
     template <class ThinkerType>
-    typename ThinkerType::Present run(
+    shared_ptr<ThinkerType> holdThinker(
         unique_ptr<ThinkerType> holder,
         codeplace const & cp
     ){
@@ -139,7 +267,7 @@ class ThinkerManager : public QObject {
         // whichever thread happens to be the last one to release a reference).
         // A custom deleter addresses this and we use Qt's "deleteLater()"
         //
-        shared_ptr<ThinkerType> shared (
+        return shared_ptr<ThinkerType> (
             holder.release(),
             [] (ThinkerType* thinker) {
                 if (thinker == nullptr) {
@@ -152,10 +280,48 @@ class ThinkerManager : public QObject {
                     thinker->deleteLater();
             }
         );
+    }
 
-        createRunnerForThinker(shared, cp);
+  public:  // https://github.com/hostilefork/thinker-qt/issues/5
+    template <class ThinkerType>
+    typename ThinkerType::Present run(
+        unique_ptr<ThinkerType> holder,
+        int priority,
+        codeplace const & cp
+    ){
+        shared_ptr<ThinkerType> shared = holdThinker(std::move(holder), cp);
 
-        return typename ThinkerType::Present (shared);
+        createRunnerForThinker(shared, priority, nullptr, cp);
+
+        ThinkerPresentBase present (shared);
+        applyAbandonPolicy(present);
+        return typename ThinkerType::Present (present);
+    }
+
+    // The thinker becomes a member of the group (see ThinkerGroup::run())
+    //
+    template <class ThinkerType>
+    typename ThinkerType::Present run(
+        unique_ptr<ThinkerType> holder,
+        ThinkerGroup & group,
+        int priority,
+        codeplace const & cp
+    ){
+        shared_ptr<ThinkerType> shared = holdThinker(std::move(holder), cp);
+
+        createRunnerForThinker(shared, priority, &group, cp);
+
+        ThinkerPresentBase present (shared);
+        applyAbandonPolicy(present);
+        return typename ThinkerType::Present (present);
+    }
+
+    template <class ThinkerType>
+    typename ThinkerType::Present run(
+        unique_ptr<ThinkerType> holder,
+        codeplace const & cp
+    ){
+        return run(std::move(holder), NormalPriority, cp);
     }
 
     // https://github.com/hostilefork/thinker-qt/issues/5
@@ -163,36 +329,24 @@ class ThinkerManager : public QObject {
     template <class ThinkerType>
     ThinkerPresentBase runBase (
         unique_ptr<ThinkerType> holder, 
+        int priority,
         codeplace const & cp
     ){
-        // It's a QObject, but we're taking ownership...
-        //
-        hopefully(not holder->parent(), cp); 
+        shared_ptr<ThinkerType> shared = holdThinker(std::move(holder), cp);
 
-        // We only want to run the destructor of the Thinker on the thread
-        // where it was created.  But if we use shared_ptr to a Thinker then
-        // that means we are surrendering the control of which thread will
-        // actually be the one to perform the deletion (it will happen on
-        // whichever thread happens to be the last one to release a reference).
-        // A custom deleter addresses this and we use Qt's "deleteLater()"
-        //
-        shared_ptr<ThinkerType> shared (
-            holder.release(),
-            [] (ThinkerType* thinker) {
-                if (thinker == nullptr) {
-                    return;
-                }
+        createRunnerForThinker(shared, priority, nullptr, cp);
 
-                if (thinker->thread() == QThread::currentThread())
-                    delete thinker;
-                else
-                    thinker->deleteLater();
-            }
-        );
-
-        createRunnerForThinker(shared, cp);
+        ThinkerPresentBase present (shared);
+        applyAbandonPolicy(present);
+        return present;
+    }
 
-        return ThinkerPresentBase (shared);
+    template <class ThinkerType>
+    ThinkerPresentBase runBase (
+        unique_ptr<ThinkerType> holder,
+        codeplace const & cp
+    ){
+        return runBase(std::move(holder), NormalPriority, cp);
     }
 
   public:
@@ -201,6 +355,14 @@ class ThinkerManager : public QObject {
     void requestAndWaitForCancelButAlreadyCanceledIsOkay(
         ThinkerBase & thinker
     );
+
+    // Doesn't wait for the thinker to unwind.  If given, onCanceled is run on
+    // the manager thread once it has (right away, if it already had).
+    //
+    void requestCancelAsync(
+        ThinkerBase & thinker,
+        std::function<void()> onCanceled
+    );
     void ensureThinkerFinished(ThinkerBase & thinker);
 
   #ifndef THINKERQT_REQUIRE_CODEPLACE
@@ -213,6 +375,13 @@ class ThinkerManager : public QObject {
     typename ThinkerType::Present run(unique_ptr<ThinkerType>&& thinker)
       { return run(std::move(thinker), HERE); }
 
+    template <class ThinkerType>
+    typename ThinkerType::Present run(
+        unique_ptr<ThinkerType>&& thinker,
+        int priority
+    )
+      { return run(std::move(thinker), priority, HERE); }
+
     void ensureThinkersPaused()
       { ensureThinkersPaused(HERE); }
 
@@ -221,10 +390,8 @@ class ThinkerManager : public QObject {
   #endif
 
   public:
-    void waitForPushToThread(ThinkerRunner * runner);
-    void processThreadPushesUntil(ThinkerRunner * runner);
-    void processThreadPushes()
-      { processThreadPushesUntil(nullptr); }
+    void queueRunner(ThinkerRunnerProxy * proxy, int priority);
+    bool requeueRunner(ThinkerRunnerProxy * proxy, int priority);
 
   public:
     void addToThinkerMap(shared_ptr<ThinkerRunner> runner);
@@ -252,22 +419,94 @@ class ThinkerManager : public QObject {
     shared_ptr<ThinkerRunner> maybeGetRunnerForThinker(
         ThinkerBase const & thinker
     );
+
+    // For looking at a thinker's runner without a reference to it.  While a
+    // pin is held, the manager can let go of the thinker's runner but won't
+    // free it.  So only keep one for as long as it takes to ask the runner
+    // something, and never across a wait.  Empty if the thinker has finished
+    // or been canceled.
+    //
+    class RunnerPin {
+      public:
+        explicit RunnerPin (ThinkerBase const & thinker);
+        RunnerPin (RunnerPin const & other) = delete;
+        ~RunnerPin ();
+
+        ThinkerRunner * operator->() const
+          { return _runner; }
+
+        explicit operator bool() const
+          { return _runner != nullptr; }
+
+      private:
+        ThinkerBase const & _thinker;
+        ThinkerRunner * _runner;
+    };
     shared_ptr<ThinkerRunner> maybeGetRunnerForThread(
         QThread const & thread
     );
 
+    // Asking about the current thread (which is what nearly every thread
+    // check does) doesn't need the thread map.  The runner on each pool
+    // thread is also kept in a thread_local, set and cleared along with the
+    // thread's map entry in addToThreadMap() and removeFromThreadMap().
+    //
+    ThinkerRunner * maybeGetCurrentRunner();
+    static thread_local ThinkerRunner * _currentRunner;
+
     friend class ThinkerPresentBase;
+    friend class ThinkerGraph;
+
+  private:
+    // Which runner (if any) each pool thread is running.  Every thread check
+    // consults this, so it is split into shards that are locked separately,
+    // and threads only contend when they happen to hash to the same one.
+    //
+    struct alignas(64) ThreadMapShard {
+        QMutex mutex;
+        QMap<QThread const *, shared_ptr<ThinkerRunner>> map;
+    };
+    static int const threadMapShardCount = 16;
+
+    ThreadMapShard & getThreadMapShard(QThread const & thread);
 
   private:
     SignalThrottler _anyThinkerWrittenThrottler;
-    QMutex _mapsMutex;
-    QMap<QThread const *, shared_ptr<ThinkerRunner>> _threadMap;
+
+    // Every live runner, for when the manager has to go over all of them.
+    // Finding the runner for one thinker goes through ThinkerBase::_runner
+    // instead, so this lock is kept off the paths that Presents poll.
+    //
+    QMutex _thinkerMapMutex;
     QMap<ThinkerBase const *, shared_ptr<ThinkerRunner>> _thinkerMap;
 
-    QMutex _pushThreadMutex;
-    QWaitCondition _threadsWerePushed;
-    QWaitCondition _threadsNeedPushing;
-    QSet<ThinkerRunner *> _runnerSetToPush;
+    ThreadMapShard _threadMapShards[threadMapShardCount];
+
+    mutable QMutex _threadNameMutex;
+    QString _threadName;
+
+    // What was asked for through setMaxThreadCount() and the others, so
+    // setExecutor() can give it to a new executor.  Manager thread only.
+    //
+    bool _maxThreadCountWasSet;
+    int _maxThreadCount;
+    bool _stackSizeWasSet;
+    uint _stackSize;
+    bool _expiryTimeoutWasSet;
+    int _expiryTimeout;
+
+    // Only set on the manager thread, but continuations read them from
+    // pool threads
+    //
+  #if THINKERQT_USE_FIBERS
+    std::atomic<std::size_t> _fiberStackSize;
+  #endif
+    std::atomic<AbandonPolicy> _abandonPolicy;
+
+    // Declared last so it is destroyed first; executors wait for any runners
+    // still on them when destroyed, and those use the members above
+    //
+    unique_ptr<ThinkerExecutor> _executor;
 };
 
 #endif
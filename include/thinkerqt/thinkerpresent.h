@@ -22,13 +22,18 @@
 #ifndef THINKERQT_THINKERPRESENT_H
 #define THINKERQT_THINKERPRESENT_H
 
+#include <functional>
+
 #include <QThread>
+#include <QString>
 
 #include "defs.h"
 #include "snapshottable.h"
 
 class ThinkerBase;
 class ThinkerManager;
+class ThinkerSharing;
+class ThinkerInterest;
 
 
 //
@@ -55,10 +60,19 @@ public:
 
 protected:
     friend class ThinkerManager;
+    friend class ThinkerSharing;
 
     ThinkerPresentBase (shared_ptr<ThinkerBase> holder);
 
 
+public:
+    // Null unless this Present is one of several parties sharing the thinker
+    // (see ThinkerSharing).  Then its cancel() only cancels the thinker if
+    // no other party is left.
+    //
+    shared_ptr<ThinkerSharing> getSharing () const;
+
+
 public:
     bool operator!= (ThinkerPresentBase const & other) const;
 
@@ -67,8 +81,18 @@ public:
 
 protected:
     friend class ThinkerPresentWatcherBase;
+    template <class> friend class ThinkerResultReader;
+
+    // The primary restriction on communicating with a thinker with a
+    // Present or a PresentWatcher is that we are not doing so on
+    // the same thread that the Thinker itself is running on.  We
+    // can take snapshots and such from pretty much any other thread
+    // in the system.
+    //
+    bool isCurrentThreadDifferent () const;
 
-    bool hopefullyCurrentThreadIsDifferent (codeplace const & cp) const;
+    bool hopefullyCurrentThreadIsDifferent (codeplace const & cp) const
+      { return hopefully(isCurrentThreadDifferent(), cp); }
 
 
 protected:
@@ -80,23 +104,11 @@ protected:
 
 
 public:
-    // QFuture thinks of returning a list of results, whereas we snapshot
-#if RETURN_LIST_OF_RESULTS_LIKE_QFUTURE
-
-    T result () const;
-
-    operator T () const;
-
-    T resultAt (int index) const;
-
-    int resultCount () const;
-
-    QList<T> results () const;
-
-    bool isResultReadyAt (int index) const;
-
-#endif
-
+    // QFuture thinks of returning a list of results, whereas we snapshot.
+    // (A thinker that wants to stream out a list of results as well can
+    // derive from ThinkerResults, and they are read with a
+    // ThinkerResultReader made from its Present.  See thinkerresults.h)
+    //
     SnapshotBase * createSnapshotBase () const;
 
 
@@ -121,6 +133,14 @@ public:
 
     void cancel ();
 
+    // Like cancel(), this only requests that the thinker stop.  onCanceled
+    // is then run on the manager thread when the thinker has actually
+    // unwound and let go of its pool thread.  (A watcher's canceled() signal
+    // reports the same moment.)  A shared Present can't be given a callback,
+    // as canceling it may not cancel the thinker.
+    //
+    void cancelAsync (std::function<void()> onCanceled);
+
     void pause ();
 
     void resumeMaybeEmitDone ();
@@ -130,14 +150,53 @@ public:
     void togglePaused ();
 
 
+    // If the thinker is still queued waiting for a thread, this moves it
+    // ahead of (or behind) other queued thinkers.  It is a no-op on thinkers
+    // that are already running, finished, or canceled.
+    //
+    void setPriority (int priority);
+
+    int priority () const;
+
+
     void waitForFinished ();
 
 
-public:
-    // TODO: Should Thinkers implement a progress API like QFuture?
-    // QFuture's does not apply to run() interfaces...
-#if OFFER_PROGRESS_API_LIKE_QFUTURE
+protected:
+    friend class ThinkerCacheBase;
+    friend class ThinkerGraph;
+
+    // Calls back with a Present for the thinker once it has finished or been
+    // canceled.  That's on the pool thread it ran on, right after the thread
+    // lets go of it--or right away on this thread, if that already happened.
+    // The Present passed isn't a party to any sharing, so waiting on the
+    // thinker doesn't keep it from being abandoned.
+    //
+    void whenEnded (std::function<void(ThinkerPresentBase &)> callback);
+
+    // Once the thinker has finished, makeNext is called with a Present for
+    // it and the thinker it returns (if any) is run.  See Thinker::Present's
+    // then(), which is what this is for.
+    //
+    void thenBase (
+        std::function<unique_ptr<ThinkerBase>(ThinkerPresentBase &)> makeNext,
+        std::function<void(ThinkerPresentBase &)> started,
+        int priority
+    );
+
+    void thenBase (
+        std::function<unique_ptr<ThinkerBase>(ThinkerPresentBase &)> makeNext,
+        std::function<void(ThinkerPresentBase &)> started
+    );
 
+
+#if OFFER_PROGRESS_API_LIKE_QFUTURE
+public:
+    // What the thinker last passed to ThinkerBase::setProgress() and
+    // setProgressRange().  Each is read on its own without locking, so a
+    // value and a range that were set together may be seen apart.  An empty
+    // Present reports 0 and an empty string.
+    //
     int progressMaximum () const;
 
     int progressMinimum () const;
@@ -151,6 +210,7 @@ public:
 
 protected:
     shared_ptr<ThinkerBase> _holder;
+    shared_ptr<ThinkerInterest> _interest;  // null unless shared
 
     // Should this be DEBUG only?
     QThread * _thread;
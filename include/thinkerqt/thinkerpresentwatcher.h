@@ -52,6 +52,12 @@ class ThinkerPresentWatcherBase : public QObject
   signals:
     void written();
     void finished();
+    void canceled();
+
+    // Throttled like written(), but for ThinkerBase::setProgress() and its
+    // relatives.  (Never emitted if OFFER_PROGRESS_API_LIKE_QFUTURE is off.)
+    //
+    void progressChanged();
 
   public:
     void setThrottleTime(unsigned int milliseconds);
@@ -72,10 +78,29 @@ class ThinkerPresentWatcherBase : public QObject
     bool isPaused() const
       { return _present.isPaused(); }
 
+  #if OFFER_PROGRESS_API_LIKE_QFUTURE
+    int progressMaximum() const
+      { return _present.progressMaximum(); }
+
+    int progressMinimum() const
+      { return _present.progressMinimum(); }
+
+    QString progressText() const
+      { return _present.progressText(); }
+
+    int progressValue() const
+      { return _present.progressValue(); }
+  #endif
+
   public slots:
     void cancel()
       { _present.cancel(); }
 
+    // Doesn't block; the canceled() signal says when the thinker is gone
+    //
+    void cancelAsync()
+      { _present.cancelAsync(nullptr); }
+
     void pause()
       { _present.pause(); }
 
@@ -88,6 +113,9 @@ class ThinkerPresentWatcherBase : public QObject
     void togglePaused()
       { _present.togglePaused(); }
 
+    void setPriority(int priority)
+      { _present.setPriority(priority); }
+
   public:
     void waitForFinished()
       { _present.waitForFinished(); }
@@ -102,9 +130,9 @@ class ThinkerPresentWatcherBase : public QObject
 
   protected:
     bool hopefullyCurrentThreadIsDifferent(codeplace const & cp) const {
-        if (_present == ThinkerPresentBase())
-            return true;
-
+        //
+        // (An empty present always passes this test)
+        //
         return _present.hopefullyCurrentThreadIsDifferent(cp);
     }
 
@@ -116,6 +144,7 @@ class ThinkerPresentWatcherBase : public QObject
     ThinkerPresentBase _present;
     unsigned int _milliseconds;
     QSharedPointer<SignalThrottler> _notificationThrottler;
+    QSharedPointer<SignalThrottler> _progressThrottler;
     friend class ThinkerBase;
 };
 
@@ -0,0 +1,312 @@
+//
+// thinkerresults.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERRESULTS_H
+#define THINKERQT_THINKERRESULTS_H
+
+#include <atomic>
+#include <limits>
+#include <new>
+#include <utility>
+
+#include <QList>
+
+#include "defs.h"
+#include "thinker.h"
+
+#if RETURN_LIST_OF_RESULTS_LIKE_QFUTURE
+
+
+//
+// ThinkerResultLog
+//
+// An append-only list that one thread adds to while any number of others
+// read it, without locks.  Items are never moved once added, so a reader
+// can hold on to a reference to one for as long as the log exists.
+//
+// The items go in chunks that double in size: the first holds 32 items,
+// the next 64, and so on.  That way the table of chunks never has to grow,
+// and readers never see it change under them.  Adding an item only
+// allocates at the start of a chunk, and doesn't copy anything that's
+// already there.
+//
+
+template <class R>
+class ThinkerResultLog
+{
+  private:
+    static const int firstChunkSize = 32;
+    static const int maxChunks = 27;  // enough for any int index
+
+  public:
+    ThinkerResultLog () :
+        _count (0)
+    {
+        for (int chunk = 0; chunk < maxChunks; ++chunk)
+            _chunks[chunk].store(nullptr, std::memory_order_relaxed);
+    }
+
+    ThinkerResultLog (ThinkerResultLog const & other) = delete;
+
+    ThinkerResultLog & operator= (ThinkerResultLog const & other) = delete;
+
+    ~ThinkerResultLog () {
+        int count = _count.load(std::memory_order_relaxed);
+        for (int index = 0; index < count; ++index)
+            const_cast<R &>(at(index)).~R();
+
+        for (int chunk = 0; chunk < maxChunks; ++chunk)
+            ::operator delete(_chunks[chunk].load(std::memory_order_relaxed));
+    }
+
+  public:
+    // Only one thread may append.  The count is published after the item
+    // has been constructed, so a reader that sees the new count sees the
+    // whole item.
+    //
+    template <class Arg>
+    void append(Arg && arg) {
+        int index = _count.load(std::memory_order_relaxed);
+        hopefully(index < std::numeric_limits<int>::max(), HERE);
+
+        int chunk;
+        int offset;
+        locate(index, chunk, offset);
+
+        R * items = _chunks[chunk].load(std::memory_order_relaxed);
+        if (offset == 0) {
+            items = static_cast<R *>(
+                ::operator new(
+                    sizeof(R) * (static_cast<size_t>(firstChunkSize) << chunk)
+                )
+            );
+            _chunks[chunk].store(items, std::memory_order_release);
+        }
+
+        new (items + offset) R (std::forward<Arg>(arg));
+
+        _count.store(index + 1, std::memory_order_release);
+    }
+
+    int count() const
+      { return _count.load(std::memory_order_acquire); }
+
+    R const & at(int index) const {
+        hopefully(index >= 0 and index < count(), HERE);
+
+        int chunk;
+        int offset;
+        locate(index, chunk, offset);
+
+        return _chunks[chunk].load(std::memory_order_acquire)[offset];
+    }
+
+  private:
+    // Chunk c starts at index firstChunkSize * (2^c - 1)
+    //
+    static void locate(int index, int & chunk, int & offset) {
+        int n = index / firstChunkSize + 1;
+
+        chunk = 0;
+        while ((n >> (chunk + 1)) != 0)
+            ++chunk;
+
+        offset = index - firstChunkSize * ((1 << chunk) - 1);
+    }
+
+  private:
+    std::atomic<R *> _chunks[maxChunks];
+    std::atomic<int> _count;
+};
+
+
+//
+// ThinkerResults
+//
+// QFuture can hand back a list of results as they are reported, where a
+// thinker's snapshots only ever give back one blob of data.  A thinker that
+// streams out items (tiles, search hits...) would have to grow a container
+// inside its DataType, and every snapshot after a write would copy it.
+//
+// Deriving a thinker from ThinkerResults<R> too gives it a log of results
+// instead.  Only the thinker's own thread may report them, and each one is
+// copied once, into the log.  Reporting a result also gets watchers a
+// (throttled) written() signal, as unlocking does.  Read the results with a
+// ThinkerResultReader.
+//
+//     class TileThinker : public Thinker<Stats>, public ThinkerResults<Tile>
+//
+
+template <class R>
+class ThinkerResults
+{
+  public:
+    typedef R ResultType;
+
+  public:
+    ThinkerResults () :
+        _thinker (nullptr),
+        _log ()
+      { }
+
+    virtual ~ThinkerResults ()
+      { }
+
+  protected:
+    void reportResult(R const & result, codeplace const & cp)
+      { report(result, cp); }
+
+    void reportResult(R && result, codeplace const & cp)
+      { report(std::move(result), cp); }
+
+  #ifndef THINKERQT_REQUIRE_CODEPLACE
+    //
+    // This will cause any asserts to indicate a failure in thinkerresults.h
+    // instead of the offending line in the caller... not as good... see hoist
+    // documentation http://hostilefork.com/hoist/
+    //
+    void reportResult(R const & result)
+      { report(result, HERE); }
+
+    void reportResult(R && result)
+      { report(std::move(result), HERE); }
+  #endif
+
+  private:
+    template <class Arg>
+    void report(Arg && result, codeplace const & cp) {
+        //
+        // Only the thinker's thread gets here, so this is only ever set once
+        // (and saves a cross cast on every result after the first)
+        //
+        if (_thinker == nullptr) {
+            _thinker = dynamic_cast<ThinkerBase *>(this);
+            hopefully(_thinker != nullptr, cp);  // must also be a thinker
+        }
+
+        // Not from the helper threads of a parallelFor(), which would make
+        // for more than one producer
+        //
+        hopefully(QThread::currentThread() == _thinker->thread(), cp);
+
+        _log.append(std::forward<Arg>(result));
+
+        _thinker->notifyWritten();
+    }
+
+  private:
+    template <class> friend class ThinkerResultReader;
+
+    ThinkerBase * _thinker;
+    ThinkerResultLog<R> _log;
+};
+
+
+//
+// ThinkerResultReader
+//
+// Reads the results a thinker has reported so far, from any thread other
+// than the thinker's.  The reader keeps the thinker alive, and references
+// it hands out stay good for as long as it does.
+//
+// Besides reading by index, a reader has a position for picking up where
+// it left off: when a watcher says the thinker was written, call next()
+// until hasNext() is false to get only the results that are new.
+//
+
+template <class R>
+class ThinkerResultReader
+{
+  public:
+    ThinkerResultReader () :
+        _present (),
+        _log (nullptr),
+        _index (0)
+      { }
+
+    explicit ThinkerResultReader (ThinkerPresentBase present, int index = 0) :
+        _present (present),
+        _log (nullptr),
+        _index (index)
+    {
+        if (_present == ThinkerPresentBase ())
+            return;
+
+        auto results = dynamic_cast<ThinkerResults<R> const *>(
+            &_present.getThinkerBase()
+        );
+        hopefully(results != nullptr, HERE);  // thinker doesn't report R
+        _log = &results->_log;
+    }
+
+  public:
+    ThinkerPresentBase presentBase() const
+      { return _present; }
+
+    // An empty reader has no results
+    //
+    int resultCount() const {
+        _present.hopefullyCurrentThreadIsDifferent(HERE);
+        return _log ? _log->count() : 0;
+    }
+
+    bool isResultReadyAt(int index) const
+      { return index >= 0 and index < resultCount(); }
+
+    R const & resultAt(int index) const {
+        _present.hopefullyCurrentThreadIsDifferent(HERE);
+        hopefully(_log != nullptr, HERE);
+        return _log->at(index);
+    }
+
+    // Copies the results from index on (so avoid calling it with 0 over and
+    // over as the results come in)
+    //
+    QList<R> results(int from = 0) const {
+        QList<R> list;
+        int count = resultCount();
+        for (int index = from; index < count; ++index)
+            list.append(_log->at(index));
+        return list;
+    }
+
+  public:
+    int index() const
+      { return _index; }
+
+    void seek(int index)
+      { _index = index; }
+
+    bool hasNext() const
+      { return _index < resultCount(); }
+
+    R const & next()
+      { return resultAt(_index++); }
+
+  private:
+    ThinkerPresentBase _present;
+    ThinkerResultLog<R> const * _log;
+    int _index;
+};
+
+#endif
+
+#endif
@@ -22,28 +22,36 @@
 #ifndef THINKERQT_THINKERRUNNER_H
 #define THINKERQT_THINKERRUNNER_H
 
+#include <atomic>
+#include <climits>
+#include <functional>
+
 #include <QWaitCondition>
 #include <QMutex>
 #include <QSemaphore>
 #include <QRunnable>
 #include <QEventLoop>
-#include <QTextStream>
+#include <QList>
 
 #include "thinkerqt/thinker.h"
+#include "thinkerqt/thinkermanager.h"
+#include "thinkerqt/thinkerfiber.h"
+#include "thinkerqt/thinkergroup.h"
 
 class ThinkerRunnerHelper;
 class ThinkerManager;
 class ThinkerRunnerProxy;
 
-class ThinkerRunner : public QEventLoop
+class ThinkerRunner :
+    public QEventLoop,
+    public std::enable_shared_from_this<ThinkerRunner>
 {
     Q_OBJECT
 
   private:
     enum class State {
-        Queued,  // => ThreadPush
+        Queued,  // => Thinking
         QueuedButPaused,  // => Queued, Paused
-        ThreadPush,  // => Thinking
         Thinking,  // => Pausing, Canceling, Finished
         Pausing,  // => Paused
         Paused,  // => Canceled, Resuming
@@ -54,7 +62,16 @@ class ThinkerRunner : public QEventLoop
     };
 
   public:
-    ThinkerRunner (shared_ptr<ThinkerBase> holder);
+    // The group control is null unless the thinker was run in a group.  A
+    // nonzero fiberStackSize runs the thinker on a ThinkerFiber of that size
+    // (only available in builds with THINKERQT_USE_FIBERS).
+    //
+    ThinkerRunner (
+        shared_ptr<ThinkerBase> holder,
+        int priority,
+        shared_ptr<ThinkerGroupControl> group,
+        std::size_t fiberStackSize = 0
+    );
     virtual ~ThinkerRunner () override;
 
   public:
@@ -62,13 +79,26 @@ class ThinkerRunner : public QEventLoop
     ThinkerBase & getThinker();
     ThinkerBase const & getThinker() const;
 
-  public:
-    void doThreadPushIfNecessary();
+    ThinkerGroupControl * getGroupControl() const
+      { return _group.get(); }
 
   public:
-    bool hopefullyCurrentThreadIsRun(codeplace const & cp) const;
-    bool hopefullyCurrentThreadIsManager(codeplace const & cp) const;
-    bool hopefullyCurrentThreadIsNotThinker(codeplace const & cp) const;
+    bool hopefullyCurrentThreadIsRun(codeplace const & cp) const {
+        return hopefully(
+            _helper and (QThread::currentThread() == getThinker().thread()),
+            cp
+        );
+    }
+
+    bool hopefullyCurrentThreadIsManager(codeplace const & cp) const {
+        return hopefully(
+            QThread::currentThread() == getManager().thread(),
+            cp
+        );
+    }
+
+    bool hopefullyCurrentThreadIsNotThinker(codeplace const & cp) const
+      { return hopefully(not getManager().isCurrentThreadThinker(), cp); }
 
   signals:
     void breakEventLoop();
@@ -108,14 +138,34 @@ class ThinkerRunner : public QEventLoop
     void waitForResume(codeplace const & cp);
     void waitForFinished(codeplace const & cp);
 
+    // Only has an effect on the order of dispatch if the runner is still
+    // waiting in the pool's queue; once it has a thread it keeps it
+    //
+    void setPriority(int priority, codeplace const & cp);
+    int priority() const;
+
+    // Callbacks to run once the runner is canceled and done.  The manager
+    // takes them when it lets go of the runner; adding one after that
+    // fails, and the caller has to arrange for it to run itself.
+    //
+    bool addCanceledCallback(std::function<void()> callback);
+    QList<std::function<void()>> takeCanceledCallbacks();
+
+    // Same, for callbacks to run once the runner has either finished or
+    // been canceled.  The manager runs these on the pool thread as soon as
+    // the runner lets go of it, after the thinker's state is final.
+    //
+    bool addEndedCallback(std::function<void()> callback);
+    QList<std::function<void()>> takeEndedCallbacks();
+
   public:
     bool isFinished() const;
     bool isCanceled() const;
     bool isPaused() const;
-    bool wasPauseRequested(unsigned long time = 0) const;
+    bool wasPauseRequested(unsigned long time = 0);
 
   #ifndef Q_NO_EXCEPTIONS
-    void pollForStopException(unsigned long time = 0) const;
+    void pollForStopException(unsigned long time = 0);
   #endif
 
   protected:
@@ -135,6 +185,49 @@ class ThinkerRunner : public QEventLoop
     );
     void requestResumeCore(bool isCanceledOkay, codeplace const & cp);
 
+  private:
+    State state() const
+      { return _state.load(std::memory_order_acquire); }
+
+    static bool stateIn(State state, State first)
+      { return state == first; }
+
+    template <class... Rest>
+    static bool stateIn(State state, State first, Rest... rest)
+      { return (state == first) or stateIn(state, rest...); }
+
+    // On failure, expected is updated to the state that was found instead
+    //
+    bool compareAndSwapState(State & expected, State desired);
+    bool tryTransition(State from, State to);
+    void transition(State from, State to, codeplace const & cp);
+
+    // Returns false only if the time ran out with the state still unchanged
+    //
+    bool waitForStateChange(State from, unsigned long time = ULONG_MAX) const;
+
+    // Used by the thinker's side while it is Paused or QueuedButPaused, and
+    // returns after the state has changed.  On a fiber, this gives the pool
+    // thread back in the meantime.
+    //
+    void sleepWhilePaused(State paused);
+
+    // Members of a group count themselves as running in it while they are
+    // executing thinker code, and sleep while the group is paused.  These
+    // do nothing for runners that aren't in a group.
+    //
+    void joinGroupRunning();
+    void leaveGroupRunning();
+    void sleepWhileGroupPaused();
+    void wakeGroup();
+
+  #if THINKERQT_USE_FIBERS
+    bool isOnFiber() const;
+    void fiberSuspended();
+    void unparkFiberIfNecessary();
+    void requeueFiber();
+  #endif
+
   #ifndef Q_NO_EXCEPTIONS
   private:
     class StopException {
@@ -142,17 +235,58 @@ class ThinkerRunner : public QEventLoop
   #endif
 
   private:
-    tracked<State> _state;
-
-    // for communication between one manager and one thinker so use wakeOne()
+    std::atomic<State> _state;
+
+    // Only used to block when waiting on a state change, and then only if
+    // _waiters says someone is.  Several parties can wait at once (e.g. a
+    // waitForFinished() and a thinker's timed wasPauseRequested()), so the
+    // wakeups are wakeAll().  Also guards _proxy, _priority and the
+    // callbacks.
+    //
     mutable QWaitCondition _stateWasChanged;
     mutable QMutex _stateMutex;
+    mutable std::atomic<int> _waiters;
+
+    // Set (with release) after any successful request to pause or cancel,
+    // and cleared by the thinker's side just before it goes back to
+    // Thinking from Resuming.  Clearing before that transition means a new
+    // pause request (which can only follow it) always sets it afterward.
+    // ThinkerBase polls this directly while we're running.
+    //
+    std::atomic<bool> _stopRequested;
 
     shared_ptr<ThinkerBase> _holder;
     QSharedPointer<ThinkerRunnerHelper> _helper;
+    shared_ptr<ThinkerGroupControl> _group;
+
+    // The proxy is only valid while we are still in the pool's queue, and is
+    // cleared once a pool thread has picked us up
+    //
+    ThinkerRunnerProxy * _proxy;
+    int _priority;
+
+    QList<std::function<void()>> _canceledCallbacks;
+    bool _canceledCallbacksTaken;
+    QList<std::function<void()>> _endedCallbacks;
+    bool _endedCallbacksTaken;
+
+    // Where the Thinker goes back to when we're done, which is the manager's
+    // thread.  (Thinkers started by Present::then() are made on a pool
+    // thread, but pool threads have no event loop to run a deleteLater().)
+    //
+    QThread * _originalThread;
+
+  #if THINKERQT_USE_FIBERS
+    std::size_t _fiberStackSize;
+    unique_ptr<ThinkerFiber> _fiber;  // created by the first pool thread
+    bool _fiberWasCanceled;
+
+    // True once a paused fiber has fully switched out and let go of its
+    // pool thread, so whoever changes the state has to requeue it
+    //
+    std::atomic<bool> _fiberParked;
+  #endif
 
-    // http://www.learncpp.com/cpp-tutorial/93-overloading-the-io-operators/
-    friend QTextStream & operator<< (QTextStream & o, State const & state);
     friend class ThinkerRunnerHelper;
 };
 
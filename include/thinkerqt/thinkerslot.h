@@ -0,0 +1,180 @@
+//
+// thinkerslot.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERSLOT_H
+#define THINKERQT_THINKERSLOT_H
+
+#include <functional>
+
+#include <QObject>
+
+#include "defs.h"
+#include "thinker.h"
+#include "thinkermanager.h"
+#include "thinkerpresentwatcher.h"
+
+
+//
+// ThinkerSlotBase
+//
+// Interactive programs tend to throw away whatever they are calculating
+// every time the user scrolls or zooms, cancel it, and run a new thinker
+// with the new parameters.  A ThinkerSlot does that bookkeeping.  It holds
+// at most one live thinker, and running a new one cancels the old one
+// without waiting for it.
+//
+// Snapshots keep coming from the old thinker until the new one has written
+// something (or finished), so there is always something to show.  And runs
+// that are requested in a burst (several in one pass through the event
+// loop) are coalesced, with only the last of them actually started.
+//
+// A slot is used from the thread it lives on, which must have an event loop.
+//
+// (The base class is needed because moc can't handle templated QObjects:
+// http://doc.trolltech.com/qq/qq15-academic.html)
+//
+
+class ThinkerSlotBase : public QObject
+{
+    Q_OBJECT
+
+  public:
+  #ifdef THINKERQT_EXPLICIT_MANAGER
+    explicit ThinkerSlotBase (ThinkerManager & mgr, QObject * parent = nullptr);
+  #else
+    explicit ThinkerSlotBase (QObject * parent = nullptr);
+  #endif
+
+    // Cancels (without waiting) whatever is running
+    //
+    ~ThinkerSlotBase () override;
+
+  signals:
+    void written();
+    void finished();
+
+  public:
+    ThinkerManager & getManager() const
+      { return _mgr; }
+
+    void setThrottleTime(unsigned int milliseconds)
+      { _watcher.setThrottleTime(milliseconds); }
+
+    // True until the first run has actually been started
+    //
+    bool isEmpty() const;
+
+    // The newest thinker, which isn't necessarily the one snapshots are
+    // being served from.  (Empty until the first run has been started.)
+    //
+    ThinkerPresentBase presentBase() const
+      { return _current; }
+
+    bool isFinished() const;
+
+  public slots:
+    // Cancels the newest thinker and any run that hasn't started yet.
+    // Snapshots are still served from whatever was being served before.
+    //
+    void cancel();
+
+  protected:
+    void runBase(std::function<ThinkerPresentBase()> launcher);
+    SnapshotBase * createSnapshotBase() const;
+
+  private:
+    void launch();
+    void serveCurrent();
+
+  private slots:
+    void currentWritten();
+    void currentFinished();
+
+  private:
+    ThinkerManager & _mgr;
+
+    ThinkerPresentBase _current;  // newest thinker that's been run
+    ThinkerPresentBase _serving;  // where snapshots come from
+    ThinkerPresentWatcherBase _watcher;  // watches _current
+
+    // The newest run that was asked for, if it hasn't been started yet
+    //
+    std::function<ThinkerPresentBase()> _launcher;
+    bool _launchQueued;
+};
+
+
+//
+// ThinkerSlot
+//
+
+template <class ThinkerType>
+class ThinkerSlot : public ThinkerSlotBase
+{
+  public:
+    typedef typename ThinkerType::Present Present;
+    typedef typename ThinkerType::Snapshot Snapshot;
+
+  public:
+  #ifdef THINKERQT_EXPLICIT_MANAGER
+    explicit ThinkerSlot (ThinkerManager & mgr, QObject * parent = nullptr) :
+        ThinkerSlotBase (mgr, parent)
+      { }
+  #else
+    explicit ThinkerSlot (QObject * parent = nullptr) :
+        ThinkerSlotBase (parent)
+      { }
+  #endif
+
+  public:
+    // The factory is called later (on this thread) if the run isn't
+    // superseded first, so it should capture its parameters by value
+    //
+    void run(
+        std::function<unique_ptr<ThinkerType>()> factory,
+        int priority = ThinkerManager::NormalPriority
+    ){
+        ThinkerManager & mgr = getManager();
+        runBase([&mgr, factory, priority]() -> ThinkerPresentBase {
+            return mgr.run(factory(), priority, HERE);
+        });
+    }
+
+    Present present() const {
+        if (isEmpty())
+            return Present ();
+
+        ThinkerPresentBase base = presentBase();
+        return Present (base);
+    }
+
+    Snapshot createSnapshot() const {
+        SnapshotBase * allocatedSnapshot = createSnapshotBase();
+        Snapshot * ptr = dynamic_cast<Snapshot *>(allocatedSnapshot);
+        hopefully(ptr != nullptr, HERE);
+
+        Snapshot result = *ptr;
+        delete allocatedSnapshot;
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,129 @@
+//
+// workstealingexecutor.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_WORKSTEALINGEXECUTOR_H
+#define THINKERQT_WORKSTEALINGEXECUTOR_H
+
+#include <atomic>
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QList>
+
+#include "defs.h"
+#include "chaselevdeque.h"
+#include "thinkerexecutor.h"
+
+
+//
+// WorkStealingExecutor
+//
+// An alternative to the default QThreadPool-based executor, for programs
+// which dispatch thousands of short thinkers and find the pool's single
+// mutex-guarded queue to be a point of contention.
+//
+// Each worker thread owns a ChaseLevDeque.  Runnables queued from one of
+// this executor's own worker threads (e.g. work spawned from inside a
+// running thinker) go onto that worker's deque without taking any locks.
+// Runnables queued from any other thread go into a shared injection queue.
+// A worker that runs out of local work steals from its siblings before it
+// checks the injection queue, and only sleeps when it finds nothing at all.
+//
+// Priorities are ignored: the deques are strictly LIFO for the owner and
+// FIFO for thieves, and tryTake() always fails.  Workers are started when
+// the first runnable is queued, and do not expire while idle.  So the thread
+// count and stack size must be set before anything is run on the executor.
+// (ThinkerManager::setExecutor() passes on whatever was set on the manager,
+// which is early enough.)
+//
+
+class WorkStealingExecutor : public ThinkerExecutor
+{
+  private:
+    class Worker : public QThread {
+      public:
+        Worker (WorkStealingExecutor & executor, int index);
+        ~Worker () override;
+
+      public:
+        void run() override;
+
+      public:
+        WorkStealingExecutor & _executor;
+        int const _index;
+        ChaseLevDeque<QRunnable *> _deque;
+    };
+
+    friend class Worker;
+
+    // Lets start() see if it's being called on one of our own threads
+    //
+    static thread_local Worker * _currentWorker;
+
+  public:
+    WorkStealingExecutor (int maxThreadCount = -1);
+    ~WorkStealingExecutor () override;
+
+  public:
+    void start(QRunnable * runnable, int priority) override;
+    bool tryTake(QRunnable * runnable) override;
+    bool waitForDone(int milliseconds = -1) override;
+
+  public:
+    void setMaxThreadCount(int maxThreadCount) override;
+    int maxThreadCount() const override;
+
+    void setStackSize(uint stackSize) override;
+    uint stackSize() const override;
+
+    void setExpiryTimeout(int milliseconds) override;
+    int expiryTimeout() const override;
+
+  private:
+    void startWorkersIfNecessary();
+    QRunnable * findWork(Worker & worker);
+    void runAndRelease(QRunnable * runnable);
+
+  private:
+    int _maxThreadCount;
+    uint _stackSize;
+
+    // Guards worker creation and the injection queue.  Workers also sleep
+    // on this mutex, but only after failing to find any work lock-free.
+    //
+    QMutex _mutex;
+    QList<Worker *> _workers;
+    QList<QRunnable *> _injected;
+    std::atomic<int> _injectedCount;  // lets workers skip _mutex when empty
+
+    QWaitCondition _workAvailable;
+    std::atomic<int> _sleepers;
+    std::atomic<bool> _stopping;
+
+    // Runnables queued but not yet finished, for waitForDone()
+    //
+    std::atomic<int> _outstanding;
+    QMutex _doneMutex;
+    QWaitCondition _allDone;
+};
+
+#endif
@@ -22,24 +22,310 @@
 #include "thinkerqt/snapshottable.h"
 
 
+//
+// SnapshotEpochs
+//
+// Each thread that has ever pinned gets a record in a list that only grows.
+// A thread that exits gives its record back, for the next new thread to use,
+// so the list is as long as the most threads that were ever pinning at once.
+//
+
+namespace {
+
+struct EpochRecord {
+    std::atomic<unsigned> pinned;  // 0, or the pinned epoch plus one
+    std::atomic<bool> inUse;
+    EpochRecord * next;
+    int depth;  // only touched by the thread using the record
+};
+
+std::atomic<unsigned> globalEpoch (0);
+std::atomic<EpochRecord *> allRecords (nullptr);
+
+
+class ThreadEpochRecord {
+public:
+    ThreadEpochRecord () :
+        record (nullptr)
+    {
+    }
+
+    ~ThreadEpochRecord () {
+        if (record != nullptr) {
+            record->pinned.store(0, std::memory_order_release);
+            record->inUse.store(false, std::memory_order_release);
+        }
+    }
+
+    EpochRecord & get () {
+        if (record != nullptr)
+            return *record;
+
+        EpochRecord * existing = allRecords.load(std::memory_order_acquire);
+        for (; existing != nullptr; existing = existing->next) {
+            bool wasInUse = false;
+            if (existing->inUse.compare_exchange_strong(wasInUse, true)) {
+                record = existing;
+                return *record;
+            }
+        }
+
+        record = new EpochRecord;
+        record->pinned.store(0, std::memory_order_relaxed);
+        record->inUse.store(true, std::memory_order_relaxed);
+        record->depth = 0;
+
+        EpochRecord * head = allRecords.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (
+            not allRecords.compare_exchange_weak(
+                head, record, std::memory_order_release
+            )
+        );
+        return *record;
+    }
+
+private:
+    EpochRecord * record;
+};
+
+thread_local ThreadEpochRecord threadRecord;
+
+} // end anonymous namespace
+
+
+void SnapshotEpochs::pin()
+{
+    EpochRecord & record = threadRecord.get();
+    if (record.depth++ != 0)
+        return;
+
+    // If the epoch moved on before our pin was seen, pin the new one
+    // instead.  Otherwise it could move on twice more while we still
+    // showed the old one.
+    //
+    unsigned epoch = globalEpoch.load(std::memory_order_relaxed);
+    while (true) {
+        record.pinned.store(epoch + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        unsigned now = globalEpoch.load(std::memory_order_relaxed);
+        if (now == epoch)
+            break;
+        epoch = now;
+    }
+}
+
+
+void SnapshotEpochs::unpin()
+{
+    EpochRecord & record = threadRecord.get();
+    hopefully(record.depth > 0, HERE);
+    if (--record.depth != 0)
+        return;
+
+    record.pinned.store(0, std::memory_order_release);
+}
+
+
+unsigned SnapshotEpochs::current()
+{
+    return globalEpoch.load(std::memory_order_seq_cst);
+}
+
+
+bool SnapshotEpochs::tryAdvance()
+{
+    unsigned epoch = globalEpoch.load(std::memory_order_seq_cst);
+
+    EpochRecord * record = allRecords.load(std::memory_order_acquire);
+    for (; record != nullptr; record = record->next) {
+        unsigned pinned = record->pinned.load(std::memory_order_seq_cst);
+        if (pinned != 0 and pinned - 1 != epoch)
+            return false;  // someone hasn't seen this epoch yet
+    }
+
+    // Losing the race means someone else advanced it, which is as good
+    //
+    globalEpoch.compare_exchange_strong(epoch, epoch + 2);
+    return true;
+}
+
+
+bool SnapshotEpochs::isReclaimable(unsigned retiredEpoch)
+{
+    // Comparing by the difference keeps this working when the epoch wraps
+    //
+    if (current() - retiredEpoch >= 4)
+        return true;
+
+    tryAdvance();
+    return current() - retiredEpoch >= 4;
+}
+
+
+
+//
+// SnapshotBase
+//
+
+quint64 SnapshotBase::version() const
+{
+    return dataBase()._version;
+}
+
+
+bool SnapshotBase::changedSince(
+    quint64 version,
+    QVector<QRect> & rects
+) const {
+    SnapshottableData const & data = dataBase();
+    if (version == data._version)
+        return true;
+
+    // Walk back through the writes until we get to the one right after the
+    // version asked about
+    //
+    SnapshotChanges const * changes = data._changes.get();
+    for (; changes != nullptr; changes = changes->previous.get()) {
+        if (changes->everything)
+            return false;
+
+        rects += changes->rects;
+
+        if (changes->previousVersion == version)
+            return true;
+    }
+
+    return false;  // not from here, or forgotten
+}
+
+
+
+//
+// SnapshottableBase
+//
+
+// How long the chain of changes gets before it is cut.  Readers usually
+// update from the snapshot before, so they only lose out (and redraw
+// everything) when a cut lands between theirs and the next.
+//
+static int const maxChangesDepth = 64;
+
+static std::atomic<quint64> versionCounter (0);
+
+
 SnapshottableBase::SnapshottableBase () :
     _dLock (),
-    _lockedForWrite (false, HERE)
+    _lockedForWrite (false, HERE),
+    _policy (LockedSnapshots),
+    _snapshotBuffers (1),
+    _written (false),
+    _version (0),
+    _tracksChanges (false),
+    _marked (false),
+    _dirty (),
+    _changes ()
+{
+}
+
+
+void SnapshottableBase::startVersions(SnapshottableData & data)
+{
+    _version = ++versionCounter;
+    data._version = _version;
+}
+
+
+void SnapshottableBase::markDirty(QRect const & rect, codeplace const & cp)
+{
+    _lockedForWrite.hopefullyEqualTo(true, cp);
+
+    _tracksChanges = true;
+    _marked = true;
+    if (not rect.isEmpty())
+        _dirty.append(rect);
+}
+
+
+void SnapshottableBase::stampVersion(SnapshottableData & data)
+{
+    // The data may be a copy of an older version (from a spare buffer), so
+    // what it says about itself can't be trusted
+    //
+    quint64 previousVersion = _version;
+
+    _version = ++versionCounter;
+    data._version = _version;
+
+    if (not _tracksChanges) {
+        data._changes = nullptr;
+        return;
+    }
+
+    auto changes = make_shared<SnapshotChanges>();
+    changes->version = data._version;
+    changes->previousVersion = previousVersion;
+    changes->everything = not _marked;
+    changes->rects = _dirty;
+
+    if (_changes != nullptr and _changes->depth < maxChangesDepth) {
+        changes->previous = _changes;
+        changes->depth = _changes->depth + 1;
+    }
+    else
+        changes->depth = 1;
+
+    _changes = changes;
+    data._changes = changes;
+}
+
+
+void SnapshottableBase::setSnapshotPolicy(
+    SnapshotPolicy policy,
+    codeplace const & cp
+){
+    _lockedForWrite.hopefullyEqualTo(false, cp);
+
+    _policy = policy;
+    if (_policy == PublishedSnapshots)
+        publishVersion();
+}
+
+
+void SnapshottableBase::setSnapshotBuffers(int buffers, codeplace const & cp)
 {
+    _lockedForWrite.hopefullyEqualTo(false, cp);
+    hopefully(buffers >= 1, cp);
+
+    _snapshotBuffers = buffers;
 }
 
 
 void SnapshottableBase::lockForWrite(codeplace const & cp)
 {
     _lockedForWrite.hopefullyTransition(false, true, cp);
-    _dLock.lockForWrite();
+    if (_policy == LockedSnapshots)
+        _dLock.lockForWrite();
+
+    _written = false;
+    _marked = false;
+    _dirty.clear();
 }
 
 
 void SnapshottableBase::unlock(codeplace const & cp)
 {
     _lockedForWrite.hopefullyTransition(true, false, cp);
-    _dLock.unlock();
+
+    if (SnapshottableData * data = writtenData())
+        stampVersion(*data);
+
+    if (_policy == LockedSnapshots)
+        _dLock.unlock();
+    else
+        publishVersion();
 }
 
 
@@ -19,26 +19,211 @@
 // See http://hostilefork.com/thinker-qt/ for more information on this project
 //
 
+#include <exception>
+
+#include <QRunnable>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QVector>
+#include <QPair>
+
 #include "thinkerqt/thinker.h"
 #include "thinkerqt/thinkermanager.h"
 #include "thinkerqt/thinkerrunner.h"
+#include "thinkerqt/thinkerpresentwatcher.h"
+
+
+//
+// ThinkerParallelRound
+//
+// One pass of ThinkerBase::parallelFor() over the chunks that still need
+// doing.  The thinker's thread and the helpers queued on the pool all claim
+// chunks from it until there are none left.  Helpers that only get a thread
+// after that find nothing to do, and just let go of the round.
+//
+
+struct ThinkerParallelChunk {
+    ThinkerBase const * thinker;
+    bool interrupted;  // told to stop while it was running
+};
+
+
+// Thrown by pollForStopException() in chunks on the helper threads, where
+// there is no runner to throw its own exception for
+//
+struct ThinkerParallelStop {
+};
+
+
+struct ThinkerParallelRound {
+    ThinkerParallelRound (
+        ThinkerBase & thinker,
+        std::function<void(int, int)> fn,
+        QList<QPair<int, int>> chunks
+    ) :
+        thinker (thinker),
+        fn (fn),
+        chunks (chunks),
+        completed (chunks.size(), false),
+        next (0),
+        stopping (false),
+        mutex (),
+        allUnwound (),
+        unwound (0)
+      #ifndef Q_NO_EXCEPTIONS
+        ,
+        error ()
+      #endif
+    {
+    }
+
+    void runChunks(bool onHelper);
+
+    ThinkerBase & thinker;
+    std::function<void(int, int)> fn;
+    QList<QPair<int, int>> chunks;
+
+    // Each entry is only written by the thread that claimed that chunk, and
+    // only read once every chunk has unwound
+    //
+    QVector<bool> completed;
+
+    std::atomic<int> next;
+    std::atomic<bool> stopping;  // a chunk was interrupted; start no more
+
+    // Guards everything below
+    //
+    QMutex mutex;
+    QWaitCondition allUnwound;
+    int unwound;
+
+  #ifndef Q_NO_EXCEPTIONS
+    std::exception_ptr error;  // the first one thrown by a chunk
+  #endif
+};
+
+
+void ThinkerParallelRound::runChunks(bool onHelper)
+{
+    int count = chunks.size();
+
+    while (true) {
+        int index = next.fetch_add(1);
+        if (index >= count)
+            return;
+
+        if (not stopping.load(std::memory_order_relaxed)) {
+            ThinkerParallelChunk chunk {&thinker, false};
+            if (onHelper)
+                ThinkerBase::_helperChunk = &chunk;
+            else
+                thinker._ownChunk = &chunk;
+
+          #ifndef Q_NO_EXCEPTIONS
+            try {
+          #endif
+                fn(chunks[index].first, chunks[index].second);
+
+          #ifndef Q_NO_EXCEPTIONS
+            } catch (ThinkerParallelStop const &) {
+                chunk.interrupted = true;
+            } catch (...) {
+                chunk.interrupted = true;
+
+                QMutexLocker lock (&mutex);
+                if (not error)
+                    error = std::current_exception();
+            }
+          #endif
+
+            if (onHelper)
+                ThinkerBase::_helperChunk = nullptr;
+            else
+                thinker._ownChunk = nullptr;
+
+            if (chunk.interrupted)
+                stopping.store(true, std::memory_order_relaxed);
+            else
+                completed[index] = true;
+        }
+
+        QMutexLocker lock (&mutex);
+        if (++unwound == count)
+            allUnwound.wakeAll();
+    }
+}
+
+
+class ThinkerParallelHelper : public QRunnable
+{
+  public:
+    ThinkerParallelHelper (shared_ptr<ThinkerParallelRound> round) :
+        QRunnable (),
+        _round (round)
+    {
+        setAutoDelete(true);
+    }
+
+    void run() override
+      { _round->runChunks(true); }
+
+  private:
+    shared_ptr<ThinkerParallelRound> _round;
+};
+
+
+
+//
+// ThinkerBase
+//
+
+thread_local ThinkerParallelChunk * ThinkerBase::_helperChunk = nullptr;
+
 
 
 #ifdef THINKERQT_EXPLICIT_MANAGER
     ThinkerBase::ThinkerBase (ThinkerManager & mgr) :
         QObject (),
         _state (State::ThinkerOwnedByRunner),
-        _mgr (mgr)
+        _mgr (mgr),
+        _stopRequested (nullptr),
+        _groupEpoch (nullptr),
+        _ownChunk (nullptr),
+        _runner (nullptr),
+        _runnerPins (0)
+      #if OFFER_PROGRESS_API_LIKE_QFUTURE
+        ,
+        _progressMinimum (0),
+        _progressMaximum (0),
+        _progressValue (0),
+        _progressText ()
+      #endif
     {
-        getManager().hopefullyCurrentThreadIsManager(HERE);
+        // Usually this is the manager thread, but then() and ThinkerGraph
+        // make the thinkers that come next on the pool thread the one before
+        // them ended on.  Only a thread that is running a thinker is out.
+        //
+        getManager().hopefullyCurrentThreadIsNotThinker(HERE);
     }
 #else
     ThinkerBase::ThinkerBase () :
         QObject (),
         _state (State::ThinkerOwnedByRunner),
-        _mgr (ThinkerManager::getGlobalManager())
+        _mgr (ThinkerManager::getGlobalManager()),
+        _stopRequested (nullptr),
+        _groupEpoch (nullptr),
+        _ownChunk (nullptr),
+        _runner (nullptr),
+        _runnerPins (0)
+      #if OFFER_PROGRESS_API_LIKE_QFUTURE
+        ,
+        _progressMinimum (0),
+        _progressMaximum (0),
+        _progressValue (0),
+        _progressText ()
+      #endif
     {
-        getManager().hopefullyCurrentThreadIsManager(HERE);
+        getManager().hopefullyCurrentThreadIsNotThinker(HERE);
     }
 #endif
 
@@ -69,22 +254,114 @@ void ThinkerBase::lockForWrite(codeplace const & cp) {
 void ThinkerBase::unlock(codeplace const & cp) {
     hopefullyCurrentThreadIsThink(HERE);
 
-    getManager().unlockThinker(*this);
+    notifyWritten();
 
     SnapshottableBase::unlock(cp);
 }
 
 
+void ThinkerBase::notifyWritten()
+{
+    getManager().unlockThinker(*this);
+}
+
+
+#if OFFER_PROGRESS_API_LIKE_QFUTURE
+
+void ThinkerBase::setProgressRange(int minimum, int maximum)
+{
+    hopefullyCurrentThreadIsThink(HERE);
+    hopefully(minimum <= maximum, HERE);
+
+    int oldMinimum = _progressMinimum.exchange(minimum);
+    int oldMaximum = _progressMaximum.exchange(maximum);
+
+    if ((oldMinimum != minimum) or (oldMaximum != maximum))
+        notifyProgress();
+}
+
+
+void ThinkerBase::setProgress(int value)
+{
+    hopefullyCurrentThreadIsThink(HERE);
+
+    // Thinkers tend to call this from inner loops, and usually with the same
+    // value as last time...so watchers only hear about actual changes
+    //
+    if (_progressValue.exchange(value) != value)
+        notifyProgress();
+}
+
+
+void ThinkerBase::setProgress(int value, QString const & text)
+{
+    hopefullyCurrentThreadIsThink(HERE);
+
+    bool changed = (_progressValue.exchange(value) != value);
+
+    shared_ptr<QString const> oldText = std::atomic_load(&_progressText);
+    if (oldText ? (*oldText != text) : not text.isEmpty()) {
+        std::atomic_store(
+            &_progressText, shared_ptr<QString const> (new QString (text))
+        );
+        changed = true;
+    }
+
+    if (changed)
+        notifyProgress();
+}
+
+
+void ThinkerBase::notifyProgress()
+{
+    QReadLocker lock (&_watchersLock);
+
+    for (ThinkerPresentWatcherBase * watcher : _watchers)
+        watcher->_progressThrottler->emitThrottled();
+}
+
+#endif
+
+
 bool ThinkerBase::wasPauseRequested(unsigned long time) const
 {
     hopefullyCurrentThreadIsThink(HERE);
 
+    // The common case is that we're running and no one wants us to stop.
+    // Answering that takes a relaxed load (two if we're in a group), which
+    // makes it cheap enough to poll from inner loops.  (If a load is stale we
+    // will just see the request on the next poll.)
+    //
+    if (
+        (time == 0)
+        and (_stopRequested != nullptr)
+        and not _stopRequested->load(std::memory_order_relaxed)
+        and not isGroupPaused()
+    ){
+        return false;
+    }
+
+    // Chunks of a parallelFor() on other threads are only told whether to
+    // stop.  Pausing (and waiting out a group pause) is for this thread.
+    //
+    ThinkerParallelChunk * helper = _helperChunk;
+    if ((helper != nullptr) and (helper->thinker == this)) {
+        bool stop = _stopRequested->load(std::memory_order_relaxed);
+        if (stop)
+            helper->interrupted = true;
+        return stop;
+    }
+
     auto runner = getManager().maybeGetRunnerForThinker(*this);
     if (runner == nullptr) {
         hopefully(_state == State::ThinkerFinished, HERE);
         return false;
     }
-    return runner->wasPauseRequested(time);
+
+    bool result = runner->wasPauseRequested(time);
+    if (result and (_ownChunk != nullptr))
+        _ownChunk->interrupted = true;
+    return result;
 }
 
 
@@ -93,6 +370,24 @@ bool ThinkerBase::wasPauseRequested(unsigned long time) const
     {
         hopefullyCurrentThreadIsThink(HERE);
 
+        if (
+            (time == 0)
+            and (_stopRequested != nullptr)
+            and not _stopRequested->load(std::memory_order_relaxed)
+            and not isGroupPaused()
+        ){
+            return;
+        }
+
+        ThinkerParallelChunk * helper = _helperChunk;
+        if ((helper != nullptr) and (helper->thinker == this)) {
+            if (_stopRequested->load(std::memory_order_relaxed)) {
+                helper->interrupted = true;
+                throw ThinkerParallelStop ();
+            }
+            return;
+        }
+
         auto runner = getManager().maybeGetRunnerForThinker(*this);
         if (runner == nullptr)
             hopefully(_state == State::ThinkerFinished, HERE);
@@ -102,6 +397,82 @@ bool ThinkerBase::wasPauseRequested(unsigned long time) const
 #endif
 
 
+bool ThinkerBase::isCurrentThreadChunk() const
+{
+    ThinkerParallelChunk * helper = _helperChunk;
+    return (helper != nullptr) and (helper->thinker == this);
+}
+
+
+bool ThinkerBase::parallelFor(
+    int begin,
+    int end,
+    int grain,
+    std::function<void(int, int)> fn
+){
+    hopefully(thread() == QThread::currentThread(), HERE);  // not in a chunk
+    hopefully(_ownChunk == nullptr, HERE);
+    hopefully(grain > 0, HERE);
+
+    auto runner = getManager().maybeGetRunnerForThinker(*this);
+    hopefully(runner != nullptr, HERE);
+
+    QList<QPair<int, int>> chunks;
+    int chunkBegin = begin;
+    while (chunkBegin < end) {
+        int chunkEnd = (end - chunkBegin > grain) ? chunkBegin + grain : end;
+        chunks.append(qMakePair(chunkBegin, chunkEnd));
+        chunkBegin = chunkEnd;
+    }
+
+    ThinkerExecutor & executor = getManager().getExecutor();
+
+    // Usually there's one round, but a thinker on a fiber takes pauses in
+    // place (see ThinkerManager::setFiberStackSize()).  Then the helpers may
+    // have been told to stop by a pause that is already over by the time
+    // we get here, and their chunks have to be done again.
+    //
+    while (not chunks.isEmpty()) {
+        auto round = make_shared<ThinkerParallelRound>(*this, fn, chunks);
+
+        // We're on a pool thread already
+        //
+        int helpers = qMin(chunks.size(), executor.maxThreadCount()) - 1;
+        for (int count = 0; count < helpers; ++count) {
+            executor.start(
+                new ThinkerParallelHelper (round),
+                runner->priority()
+            );
+        }
+
+        round->runChunks(false);
+
+        {
+            QMutexLocker lock (&round->mutex);
+            while (round->unwound != chunks.size())
+                round->allUnwound.wait(&round->mutex);
+        }
+
+      #ifndef Q_NO_EXCEPTIONS
+        if (round->error)
+            std::rethrow_exception(round->error);
+      #endif
+
+        QList<QPair<int, int>> remaining;
+        for (int index = 0; index < chunks.size(); ++index) {
+            if (not round->completed[index])
+                remaining.append(chunks[index]);
+        }
+        chunks = remaining;
+
+        if (not chunks.isEmpty() and wasPauseRequested())
+            return false;
+    }
+
+    return true;
+}
+
+
 ThinkerBase::~ThinkerBase ()
 {
     getManager().hopefullyCurrentThreadIsManager(HERE);
@@ -0,0 +1,95 @@
+//
+// thinkercache.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include <QMutex>
+#include <QMutexLocker>
+
+#include "thinkerqt/thinkercache.h"
+
+
+//
+// ThinkerCacheLink
+//
+// Thinkers tell us they've ended from whatever pool thread they were on,
+// and the cache may be destroyed in the meantime.  The link outlives it, and
+// the mutex keeps the cache from going away while an event is being posted
+// to it.  (Events already posted are dropped when a QObject is destroyed.)
+//
+
+struct ThinkerCacheLink {
+    QMutex mutex;
+    ThinkerCacheBase * cache;  // null once the cache is destroyed
+};
+
+
+#ifdef THINKERQT_EXPLICIT_MANAGER
+    ThinkerCacheBase::ThinkerCacheBase (
+        ThinkerManager & mgr,
+        QObject * parent
+    ) :
+        QObject (parent),
+        _mgr (mgr),
+        _link (make_shared<ThinkerCacheLink>())
+    {
+        _link->cache = this;
+    }
+#else
+    ThinkerCacheBase::ThinkerCacheBase (QObject * parent) :
+        QObject (parent),
+        _mgr (ThinkerManager::getGlobalManager()),
+        _link (make_shared<ThinkerCacheLink>())
+    {
+        _link->cache = this;
+    }
+#endif
+
+
+void ThinkerCacheBase::watch(ThinkerPresentBase & present)
+{
+    ThinkerBase const * thinker = &_mgr.getThinkerBase(present);
+
+    // The ended callback comes after the thinker's state is final.  (Its
+    // done() signal can come before that, which left us nothing to do but
+    // poll until it was.)  We only pass along the pointer, which is just
+    // used as a key; the derived class holds the Present that keeps the
+    // thinker alive until it has heard.
+    //
+    shared_ptr<ThinkerCacheLink> link = _link;
+    present.whenEnded([link, thinker](ThinkerPresentBase &) {
+        QMutexLocker lock (&link->mutex);
+        if (not link->cache)
+            return;
+
+        ThinkerCacheBase * cache = link->cache;
+        QMetaObject::invokeMethod(
+            cache,
+            [cache, thinker]() { cache->thinkerEnded(thinker); },
+            Qt::QueuedConnection
+        );
+    });
+}
+
+
+ThinkerCacheBase::~ThinkerCacheBase ()
+{
+    QMutexLocker lock (&_link->mutex);
+    _link->cache = nullptr;
+}
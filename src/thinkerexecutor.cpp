@@ -0,0 +1,106 @@
+//
+// thinkerexecutor.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include "thinkerqt/thinkerexecutor.h"
+
+
+//
+// ThinkerExecutor
+//
+
+ThinkerExecutor::~ThinkerExecutor ()
+{
+}
+
+
+
+//
+// ThinkerPoolExecutor
+//
+
+ThinkerPoolExecutor::ThinkerPoolExecutor () :
+    ThinkerExecutor (),
+    _pool ()
+{
+}
+
+
+void ThinkerPoolExecutor::start(QRunnable * runnable, int priority)
+{
+    // QThreadPool keeps its queue sorted by priority, so higher priority
+    // runnables will jump ahead of lower ones that were queued earlier
+    //
+    _pool.start(runnable, priority);
+}
+
+
+bool ThinkerPoolExecutor::tryTake(QRunnable * runnable)
+{
+    return _pool.tryTake(runnable);
+}
+
+
+bool ThinkerPoolExecutor::waitForDone(int milliseconds)
+{
+    return _pool.waitForDone(milliseconds);
+}
+
+
+void ThinkerPoolExecutor::setMaxThreadCount(int maxThreadCount)
+{
+    _pool.setMaxThreadCount(maxThreadCount);
+}
+
+
+int ThinkerPoolExecutor::maxThreadCount() const
+{
+    return _pool.maxThreadCount();
+}
+
+
+void ThinkerPoolExecutor::setStackSize(uint stackSize)
+{
+    _pool.setStackSize(stackSize);
+}
+
+
+uint ThinkerPoolExecutor::stackSize() const
+{
+    return _pool.stackSize();
+}
+
+
+void ThinkerPoolExecutor::setExpiryTimeout(int milliseconds)
+{
+    _pool.setExpiryTimeout(milliseconds);
+}
+
+
+int ThinkerPoolExecutor::expiryTimeout() const
+{
+    return _pool.expiryTimeout();
+}
+
+
+ThinkerPoolExecutor::~ThinkerPoolExecutor ()
+{
+    // QThreadPool's destructor waits for everything it has queued
+}
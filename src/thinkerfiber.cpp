@@ -0,0 +1,154 @@
+//
+// thinkerfiber.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include "thinkerqt/thinkerfiber.h"
+
+#if THINKERQT_USE_FIBERS
+
+#include <cstdint>
+
+
+namespace {
+    thread_local ThinkerFiber * currentFiber = nullptr;
+
+    // A fiber that suspends on one thread may be resumed on another, but
+    // the compiler has no idea swapcontext() can do that.  So it is free to
+    // work out the address of a thread_local once and use it again after
+    // the switch, writing to the old thread's slot.  Going through calls
+    // that are never inlined makes every access look the address up on the
+    // thread that is actually running.
+    //
+    Q_NEVER_INLINE ThinkerFiber * loadCurrentFiber()
+      { return currentFiber; }
+
+    Q_NEVER_INLINE void storeCurrentFiber(ThinkerFiber * fiber)
+      { currentFiber = fiber; }
+}
+
+
+ThinkerFiber::ThinkerFiber (
+    std::function<void()> body,
+    std::size_t stackSize
+) :
+    _body (body),
+    _stackSize (stackSize),
+    _stack (new char[stackSize]),
+    _finished (false)
+{
+    int result = getcontext(&_context);
+    hopefully(result == 0, HERE);
+
+    _context.uc_stack.ss_sp = _stack;
+    _context.uc_stack.ss_size = _stackSize;
+
+    // uc_link is consulted when trampoline() returns.  Since it points at
+    // _caller (rather than at a copy) the fiber ends by switching back to
+    // whichever thread resumed it most recently.
+    //
+    _context.uc_link = &_caller;
+
+    // makecontext() only portably passes int arguments, so the pointer to
+    // this object is split in two
+    //
+    std::uint64_t pointer = reinterpret_cast<std::uintptr_t>(this);
+    makecontext(
+        &_context,
+        reinterpret_cast<void (*)()>(&ThinkerFiber::trampoline),
+        2,
+        static_cast<int>(static_cast<std::uint32_t>(pointer >> 32)),
+        static_cast<int>(static_cast<std::uint32_t>(pointer))
+    );
+}
+
+
+void ThinkerFiber::trampoline(int high, int low)
+{
+    std::uint64_t pointer =
+        (static_cast<std::uint64_t>(static_cast<std::uint32_t>(high)) << 32)
+        | static_cast<std::uint32_t>(low);
+
+    ThinkerFiber * fiber = reinterpret_cast<ThinkerFiber *>(
+        static_cast<std::uintptr_t>(pointer)
+    );
+
+  #ifndef Q_NO_EXCEPTIONS
+    try {
+  #endif
+        fiber->_body();
+  #ifndef Q_NO_EXCEPTIONS
+    } catch (...) {
+        //
+        // There is nowhere for an exception to propagate to; the stack it
+        // would unwind into belongs to some other pool thread's run()
+        //
+        hopefullyNotReached("Exception escaped a ThinkerFiber", HERE);
+    }
+  #endif
+
+    fiber->_finished = true;
+    storeCurrentFiber(nullptr);
+
+    // returning switches to uc_link
+}
+
+
+void ThinkerFiber::resume()
+{
+    hopefully(not _finished, HERE);
+    hopefully(loadCurrentFiber() == nullptr, HERE);
+
+    storeCurrentFiber(this);
+    int result = swapcontext(&_caller, &_context);
+    hopefully(result == 0, HERE);
+    storeCurrentFiber(nullptr);
+}
+
+
+void ThinkerFiber::suspend()
+{
+    hopefully(loadCurrentFiber() == this, HERE);
+
+    storeCurrentFiber(nullptr);
+    int result = swapcontext(&_context, &_caller);
+    hopefully(result == 0, HERE);
+
+    // We may be on a different thread now
+    //
+    storeCurrentFiber(this);
+}
+
+
+ThinkerFiber * ThinkerFiber::current()
+{
+    return loadCurrentFiber();
+}
+
+
+ThinkerFiber::~ThinkerFiber ()
+{
+    // Deleting a suspended fiber would leak whatever is on its stack
+    //
+    hopefully(_finished, HERE);
+
+    delete[] _stack;
+}
+
+#endif
@@ -0,0 +1,418 @@
+//
+// thinkergraph.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include <algorithm>
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+#include "thinkerqt/thinkergraph.h"
+
+
+//
+// ThinkerGraphControl
+//
+// The part of a ThinkerGraph that the nodes' callbacks point at.  It is
+// shared, so a graph can go away while some of its nodes are still running.
+//
+
+struct ThinkerGraphControl {
+    enum class NodeState {
+        Waiting,
+        Running,
+        Finished,
+        Canceled  // or never going to run
+    };
+
+    struct Node {
+        ThinkerGraph::FactoryBase factory;
+        QList<int> inputs;
+        QList<int> outputs;
+        int cost;
+        int priority;  // assigned by start()
+        int unfinishedInputs;
+        NodeState state;
+
+        // Null until the node is run.  Not a Present, because one of those
+        // has to be destroyed on the thread it was made on, and nodes are run
+        // and looked at from all sorts of threads.
+        //
+        shared_ptr<ThinkerBase> holder;
+    };
+
+    ThinkerGraphControl () :
+        mutex (),
+        changed (),
+        nodes (),
+        started (false),
+        canceled (false),
+        ended (0)
+    {
+    }
+
+    // Marks a node that hasn't run as never going to, along with everything
+    // downstream of it.  Must be called with the mutex held.
+    //
+    void cancelWaiting(int index) {
+        Node & node = nodes[index];
+        if (node.state != NodeState::Waiting)
+            return;
+
+        node.state = NodeState::Canceled;
+        ++ended;
+
+        for (int output : node.outputs)
+            cancelWaiting(output);
+    }
+
+    // Guards everything below, and the wait condition is signaled whenever
+    // another node ends
+    //
+    QMutex mutex;
+    QWaitCondition changed;
+
+    QList<Node> nodes;  // in the order added, which is a topological order
+    bool started;
+    bool canceled;
+    int ended;  // how many nodes are Finished or Canceled
+};
+
+
+
+//
+// ThinkerGraph
+//
+
+#ifdef THINKERQT_EXPLICIT_MANAGER
+    ThinkerGraph::ThinkerGraph (ThinkerManager & mgr) :
+        _mgr (mgr),
+        _control (make_shared<ThinkerGraphControl>())
+    {
+    }
+#else
+    ThinkerGraph::ThinkerGraph () :
+        _mgr (ThinkerManager::getGlobalManager()),
+        _control (make_shared<ThinkerGraphControl>())
+    {
+    }
+#endif
+
+
+int ThinkerGraph::addBase(
+    FactoryBase factory,
+    QList<ThinkerGraphNodeBase> const & inputs,
+    int cost,
+    codeplace const & cp
+){
+    hopefully(factory != nullptr, cp);
+    hopefully(cost >= 0, cp);
+
+    QMutexLocker lock (&_control->mutex);
+
+    hopefully(not _control->started, cp);
+
+    int index = _control->nodes.size();
+
+    ThinkerGraphControl::Node node;
+    node.factory = factory;
+    node.cost = cost;
+    node.priority = 0;
+    node.unfinishedInputs = 0;
+    node.state = ThinkerGraphControl::NodeState::Waiting;
+
+    for (ThinkerGraphNodeBase const & input : inputs) {
+        //
+        // Only nodes that are already in the graph can be inputs, which is
+        // what keeps it from having cycles
+        //
+        hopefully(input._index >= 0 and input._index < index, cp);
+        if (node.inputs.contains(input._index))
+            continue;
+
+        node.inputs.append(input._index);
+        _control->nodes[input._index].outputs.append(index);
+        ++node.unfinishedInputs;
+    }
+
+    _control->nodes.append(node);
+    return index;
+}
+
+
+ThinkerPresentBase ThinkerGraph::presentBase(
+    ThinkerGraphNodeBase const & node
+) const {
+    QMutexLocker lock (&_control->mutex);
+
+    hopefully(node._index >= 0 and node._index < _control->nodes.size(), HERE);
+    shared_ptr<ThinkerBase> holder = _control->nodes[node._index].holder;
+    lock.unlock();
+
+    if (not holder)
+        return ThinkerPresentBase ();
+    return ThinkerPresentBase (holder);
+}
+
+
+void ThinkerGraph::start(int priority, codeplace const & cp)
+{
+    _mgr.hopefullyCurrentThreadIsNotThinker(cp);
+
+    QList<int> ready;
+
+    {
+        QMutexLocker lock (&_control->mutex);
+
+        hopefully(not _control->started, cp);
+        _control->started = true;
+
+        QList<ThinkerGraphControl::Node> & nodes = _control->nodes;
+
+        // The longest chain of costs from each node to the end of the graph.
+        // Outputs always come after their inputs, so going backwards means
+        // every output's chain is known by the time we need it.
+        //
+        QList<int> chains;
+        for (int index = 0; index < nodes.size(); ++index)
+            chains.append(0);
+
+        for (int index = nodes.size() - 1; index >= 0; --index) {
+            int longestOutput = 0;
+            for (int output : nodes[index].outputs)
+                longestOutput = std::max(longestOutput, chains[output]);
+            chains[index] = nodes[index].cost + longestOutput;
+        }
+
+        QList<int> ranks = chains;
+        std::sort(ranks.begin(), ranks.end());
+        ranks.erase(std::unique(ranks.begin(), ranks.end()), ranks.end());
+
+        for (int index = 0; index < nodes.size(); ++index) {
+            int rank = std::lower_bound(
+                ranks.begin(), ranks.end(), chains[index]
+            ) - ranks.begin();
+            nodes[index].priority = priority + rank;
+
+            if (nodes[index].unfinishedInputs == 0)
+                ready.append(index);
+        }
+
+        if (nodes.isEmpty())
+            _control->changed.wakeAll();
+    }
+
+    dispatch(_mgr, _control, ready);
+}
+
+
+void ThinkerGraph::dispatch(
+    ThinkerManager & mgr,
+    shared_ptr<ThinkerGraphControl> control,
+    QList<int> ready
+){
+    using NodeState = ThinkerGraphControl::NodeState;
+
+    // Highest priority first, so the executor gets the critical path even
+    // if it ignores priorities
+    //
+    {
+        QMutexLocker lock (&control->mutex);
+        std::sort(ready.begin(), ready.end(), [&control](int a, int b) {
+            return control->nodes[a].priority > control->nodes[b].priority;
+        });
+    }
+
+    for (int index : ready) {
+        FactoryBase factory;
+        QMap<int, shared_ptr<ThinkerBase>> inputs;
+        int priority;
+
+        {
+            QMutexLocker lock (&control->mutex);
+
+            ThinkerGraphControl::Node & node = control->nodes[index];
+            if (control->canceled) {
+                control->cancelWaiting(index);
+                control->changed.wakeAll();
+                continue;
+            }
+
+            hopefully(node.state == NodeState::Waiting, HERE);
+            hopefully(node.unfinishedInputs == 0, HERE);
+            node.state = NodeState::Running;
+
+            factory = node.factory;
+            for (int input : node.inputs)
+                inputs.insert(input, control->nodes[input].holder);
+            priority = node.priority;
+        }
+
+        // Snapshots and factories are kept out from under the lock, since
+        // either may take a while
+        //
+        ThinkerGraphInputs graphInputs;
+        for (int input : inputs.keys()) {
+            ThinkerPresentBase present (inputs.value(input));
+            graphInputs._snapshots.insert(
+                input,
+                shared_ptr<SnapshotBase> (present.createSnapshotBase())
+            );
+        }
+
+        unique_ptr<ThinkerBase> holder = factory(graphInputs);
+        if (not holder) {
+            nodeEnded(mgr, control, index, true);
+            continue;
+        }
+
+        shared_ptr<ThinkerBase> running = mgr.runContinuation(
+            std::move(holder), priority, HERE
+        );
+
+        bool cancelNow;
+        {
+            QMutexLocker lock (&control->mutex);
+            control->nodes[index].holder = running;
+            cancelNow = control->canceled;
+        }
+
+        // The graph may have been canceled while we were running the factory,
+        // before it could know about this node's thinker
+        //
+        ThinkerPresentBase present (running);
+        if (cancelNow)
+            present.cancelAsync(nullptr);
+
+        ThinkerManager * mgrPtr = &mgr;
+        present.whenEnded([mgrPtr, control, index](ThinkerPresentBase & ended) {
+            nodeEnded(*mgrPtr, control, index, ended.isCanceled());
+        });
+    }
+}
+
+
+void ThinkerGraph::nodeEnded(
+    ThinkerManager & mgr,
+    shared_ptr<ThinkerGraphControl> control,
+    int index,
+    bool canceled
+){
+    using NodeState = ThinkerGraphControl::NodeState;
+
+    QList<int> ready;
+
+    {
+        QMutexLocker lock (&control->mutex);
+
+        ThinkerGraphControl::Node & node = control->nodes[index];
+        hopefully(node.state == NodeState::Running, HERE);
+
+        if (canceled) {
+            node.state = NodeState::Canceled;
+            ++control->ended;
+
+            for (int output : node.outputs)
+                control->cancelWaiting(output);
+        }
+        else {
+            node.state = NodeState::Finished;
+            ++control->ended;
+
+            for (int output : node.outputs) {
+                ThinkerGraphControl::Node & next = control->nodes[output];
+                if (--next.unfinishedInputs == 0)
+                    if (next.state == NodeState::Waiting)
+                        ready.append(output);
+            }
+        }
+
+        control->changed.wakeAll();
+    }
+
+    dispatch(mgr, control, ready);
+}
+
+
+void ThinkerGraph::cancel(codeplace const & cp)
+{
+    using NodeState = ThinkerGraphControl::NodeState;
+
+    _mgr.hopefullyCurrentThreadIsNotThinker(cp);
+
+    QList<shared_ptr<ThinkerBase>> running;
+
+    {
+        QMutexLocker lock (&_control->mutex);
+
+        _control->canceled = true;
+
+        QList<ThinkerGraphControl::Node> & nodes = _control->nodes;
+        for (int index = 0; index < nodes.size(); ++index) {
+            if (nodes[index].state == NodeState::Waiting)
+                _control->cancelWaiting(index);
+            else if (nodes[index].state == NodeState::Running) {
+                //
+                // A node being started right now has no thinker yet; the
+                // dispatcher cancels it when it gets one
+                //
+                if (nodes[index].holder)
+                    running.append(nodes[index].holder);
+            }
+        }
+
+        _control->changed.wakeAll();
+    }
+
+    // Canceling finishes through nodeEnded(), which takes the lock
+    //
+    for (shared_ptr<ThinkerBase> & holder : running) {
+        ThinkerPresentBase present (holder);
+        present.cancelAsync(nullptr);
+    }
+}
+
+
+bool ThinkerGraph::isFinished() const
+{
+    QMutexLocker lock (&_control->mutex);
+
+    return _control->started
+        and (_control->ended == _control->nodes.size());
+}
+
+
+void ThinkerGraph::waitForFinished(codeplace const & cp)
+{
+    _mgr.hopefullyCurrentThreadIsNotThinker(cp);
+
+    QMutexLocker lock (&_control->mutex);
+
+    hopefully(_control->started, cp);
+
+    while (_control->ended != _control->nodes.size())
+        _control->changed.wait(&_control->mutex);
+}
+
+
+ThinkerGraph::~ThinkerGraph ()
+{
+}
@@ -0,0 +1,160 @@
+//
+// thinkergroup.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include <QMutexLocker>
+
+#include "thinkerqt/thinkergroup.h"
+#include "thinkerqt/thinkerrunner.h"
+
+
+//
+// ThinkerGroupControl
+//
+
+ThinkerGroupControl::ThinkerGroupControl () :
+    epoch (0),
+    mutex (),
+    changed (),
+    running (0),
+    runners ()
+{
+}
+
+
+ThinkerGroupControl::~ThinkerGroupControl ()
+{
+    // Every runner holds a reference to us until it's done
+    //
+    hopefully(running == 0, HERE);
+    hopefully(runners.isEmpty(), HERE);
+}
+
+
+
+//
+// ThinkerGroup
+//
+
+#ifdef THINKERQT_EXPLICIT_MANAGER
+    ThinkerGroup::ThinkerGroup (ThinkerManager & mgr) :
+        _mgr (mgr),
+        _control (make_shared<ThinkerGroupControl>())
+    {
+    }
+#else
+    ThinkerGroup::ThinkerGroup () :
+        _mgr (ThinkerManager::getGlobalManager()),
+        _control (make_shared<ThinkerGroupControl>())
+    {
+    }
+#endif
+
+
+QList<shared_ptr<ThinkerRunner>> ThinkerGroup::copyRunners()
+{
+    QMutexLocker lock (&_control->mutex);
+    return _control->runners.values();
+}
+
+
+void ThinkerGroup::pause(codeplace const & cp)
+{
+    _mgr.hopefullyCurrentThreadIsNotThinker(cp);
+
+    QMutexLocker lock (&_control->mutex);
+
+    unsigned epoch = _control->epoch.load(std::memory_order_relaxed);
+    hopefully((epoch & 1) == 0, cp);
+    _control->epoch.store(epoch + 1, std::memory_order_relaxed);
+}
+
+
+void ThinkerGroup::resume(codeplace const & cp)
+{
+    _mgr.hopefullyCurrentThreadIsNotThinker(cp);
+
+    QMutexLocker lock (&_control->mutex);
+
+    unsigned epoch = _control->epoch.load(std::memory_order_relaxed);
+    hopefully((epoch & 1) == 1, cp);
+    _control->epoch.store(epoch + 1, std::memory_order_relaxed);
+    _control->changed.wakeAll();
+}
+
+
+bool ThinkerGroup::isPaused() const
+{
+    return _control->epoch.load(std::memory_order_relaxed) & 1;
+}
+
+
+void ThinkerGroup::waitForPause(codeplace const & cp)
+{
+    _mgr.hopefullyCurrentThreadIsNotThinker(cp);
+
+    QMutexLocker lock (&_control->mutex);
+
+    // If someone resumes the group while we wait, there's nothing to wait for
+    //
+    while (
+        (_control->epoch.load(std::memory_order_relaxed) & 1)
+        and (_control->running != 0)
+    ){
+        _control->changed.wait(&_control->mutex);
+    }
+}
+
+
+void ThinkerGroup::cancel(codeplace const & cp)
+{
+    _mgr.hopefullyCurrentThreadIsNotThinker(cp);
+
+    // Members that are waiting on the group are woken by this
+    //
+    for (shared_ptr<ThinkerRunner> & runner : copyRunners())
+        runner->requestCancelButAlreadyCanceledIsOkay(cp);
+}
+
+
+void ThinkerGroup::waitForFinished(codeplace const & cp)
+{
+    _mgr.hopefullyCurrentThreadIsNotThinker(cp);
+
+    hopefully(not isPaused(), cp);
+
+    for (shared_ptr<ThinkerRunner> & runner : copyRunners())
+        hopefully(not runner->isPaused(), cp);
+
+    // Runners leave the group when their pool thread lets go of them, which
+    // is after they are finished or canceled
+    //
+    QMutexLocker lock (&_control->mutex);
+
+    while (not _control->runners.isEmpty())
+        _control->changed.wait(&_control->mutex);
+}
+
+
+ThinkerGroup::~ThinkerGroup ()
+{
+    if (isPaused())
+        resume(HERE);
+}
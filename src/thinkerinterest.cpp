@@ -0,0 +1,108 @@
+//
+// thinkerinterest.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include "thinkerqt/thinkerinterest.h"
+#include "thinkerqt/thinkerpresent.h"
+
+
+//
+// ThinkerSharing
+//
+
+ThinkerSharing::ThinkerSharing (ThinkerPresentBase const & present) :
+    _holder (present._holder),
+    _interests (0)
+{
+    hopefully(_holder != nullptr, HERE);
+}
+
+
+ThinkerPresentBase ThinkerSharing::join()
+{
+    ThinkerPresentBase present (_holder);
+    present._interest = make_shared<ThinkerInterest>(shared_from_this());
+    return present;
+}
+
+
+ThinkerPresentBase ThinkerSharing::observe() const
+{
+    return ThinkerPresentBase (_holder);
+}
+
+
+void ThinkerSharing::addInterest()
+{
+    _interests.fetch_add(1);
+}
+
+
+void ThinkerSharing::removeInterest()
+{
+    int before = _interests.fetch_sub(1);
+    hopefully(before > 0, HERE);
+
+    if (before != 1)
+        return;
+
+    // Everyone has lost interest.  There's no point in canceling a thinker
+    // that has already finished, though: it would only mark its (perfectly
+    // good) result as canceled for anyone that asks about it later.
+    //
+    ThinkerPresentBase present (_holder);
+    if (not present.isFinished())
+        present.cancelAsync(nullptr);
+}
+
+
+ThinkerSharing::~ThinkerSharing ()
+{
+    hopefully(_interests.load() == 0, HERE);
+}
+
+
+
+//
+// ThinkerInterest
+//
+
+ThinkerInterest::ThinkerInterest (shared_ptr<ThinkerSharing> sharing) :
+    _sharing (sharing),
+    _withdrawn (false)
+{
+    hopefully(_sharing != nullptr, HERE);
+    _sharing->addInterest();
+}
+
+
+void ThinkerInterest::withdraw()
+{
+    if (_withdrawn.exchange(true))
+        return;
+
+    _sharing->removeInterest();
+}
+
+
+ThinkerInterest::~ThinkerInterest ()
+{
+    withdraw();
+}
@@ -19,11 +19,12 @@
 // See http://hostilefork.com/thinker-qt/ for more information on this project
 //
 
-#include <QThreadPool>
 #include <QMutexLocker>
 
 #include "thinkerqt/thinkerrunner.h"
 #include "thinkerqt/thinkermanager.h"
+#include "thinkerqt/thinkergroup.h"
+#include "thinkerqt/thinkerinterest.h"
 
 
 #ifndef THINKERQT_EXPLICIT_MANAGER
@@ -38,7 +39,7 @@
 #endif
 
 
-ThinkerManager::ThinkerManager () :
+ThinkerManager::ThinkerManager (int maxThreadCount) :
     QObject (),
 
     // Hardcoded value; should probably be configurable.  Optional parameter
@@ -46,99 +47,270 @@ ThinkerManager::ThinkerManager () :
     //
     _anyThinkerWrittenThrottler (400),
 
-    // We create this Mutex recursively because the checks for whether a
-    // thread is in the thread pool or not require the map at the moment.
-    // Those checks may be run when a higher level routine has locked the
-    // mutex.  It may be desirable to have those assertions use a different
-    // (and possibly faster) method for the test so we wouldn't have to
-    // make this allow nested locks.
+    _thinkerMapMutex (),
+    _thinkerMap (),
+
+    _threadName ("Thinker"),
+
+    _maxThreadCountWasSet (false),
+    _maxThreadCount (0),
+    _stackSizeWasSet (false),
+    _stackSize (0),
+    _expiryTimeoutWasSet (false),
+    _expiryTimeout (0),
+
+  #if THINKERQT_USE_FIBERS
+    _fiberStackSize (0),
+  #endif
+
+    _abandonPolicy (KeepAbandonedThinkers),
+
+    // We wait on the executor explicitly in the destructor, rather than
+    // leaving it to the executor's own destructor
     //
-    _mapsMutex (QMutex::Recursive)
+    _executor (new ThinkerPoolExecutor ())
 {
     hopefullyCurrentThreadIsManager(HERE);
 
+    // Otherwise the executor's own default stands (which for a QThreadPool
+    // is QThread::idealThreadCount() anyway)
+    //
+    if (maxThreadCount > 0)
+        setMaxThreadCount(maxThreadCount);
+
     connect(
         &_anyThinkerWrittenThrottler, &SignalThrottler::throttled,
         this, &ThinkerManager::anyThinkerWritten,
         Qt::DirectConnection
     );
+}
 
-    connect(
-        this, &ThinkerManager::pushToThreadMayBeNeeded,
-        this, &ThinkerManager::doThreadPushesIfNecessary,
-        Qt::QueuedConnection
-    );
+
+void ThinkerManager::setExecutor(unique_ptr<ThinkerExecutor> executor)
+{
+    hopefullyCurrentThreadIsManager(HERE);
+    hopefully(executor != nullptr, HERE);
+
+    {
+        QMutexLocker lock (&_thinkerMapMutex);
+
+        for (shared_ptr<ThinkerRunner> runner : _thinkerMap)
+            hopefully(runner->isCanceled() or runner->isFinished(), HERE);
+    }
+
+    // Canceled runners may still be unwinding on the old executor's threads
+    //
+    _executor->waitForDone();
+
+    _executor = std::move(executor);
+
+    if (_maxThreadCountWasSet)
+        _executor->setMaxThreadCount(_maxThreadCount);
+    if (_stackSizeWasSet)
+        _executor->setStackSize(_stackSize);
+    if (_expiryTimeoutWasSet)
+        _executor->setExpiryTimeout(_expiryTimeout);
 }
 
 
-bool ThinkerManager::hopefullyThreadIsManager(
-    const QThread & thread,
-    codeplace const & cp
-){
-    return hopefully(&thread == this->thread(), cp);
+ThinkerExecutor & ThinkerManager::getExecutor()
+{
+    return *_executor;
 }
 
 
-bool ThinkerManager::hopefullyCurrentThreadIsManager(
-    codeplace const & cp
-){
-    return hopefullyThreadIsManager(*QThread::currentThread(), cp);
+void ThinkerManager::setMaxThreadCount(int maxThreadCount)
+{
+    hopefullyCurrentThreadIsManager(HERE);
+
+    _maxThreadCountWasSet = true;
+    _maxThreadCount =
+        maxThreadCount > 0 ? maxThreadCount : QThread::idealThreadCount();
+
+    _executor->setMaxThreadCount(_maxThreadCount);
 }
 
 
-bool ThinkerManager::hopefullyThreadIsNotManager(
-    const QThread & thread,
-    codeplace const & cp
-){
-    return hopefully(&thread != this->thread(), cp);
+int ThinkerManager::maxThreadCount() const
+{
+    return _executor->maxThreadCount();
 }
 
 
-bool ThinkerManager::hopefullyCurrentThreadIsNotManager(
-    codeplace const & cp
-){
-    return hopefullyThreadIsNotManager(*QThread::currentThread(), cp);
+void ThinkerManager::setStackSize(uint stackSize)
+{
+    hopefullyCurrentThreadIsManager(HERE);
+
+    _stackSizeWasSet = true;
+    _stackSize = stackSize;
+
+    _executor->setStackSize(stackSize);
 }
 
 
-bool ThinkerManager::hopefullyThreadIsNotThinker(
-    const QThread & thread,
-    codeplace const & cp
-){
-    return hopefully(maybeGetRunnerForThread(thread) == nullptr, cp);
+uint ThinkerManager::stackSize() const
+{
+    return _executor->stackSize();
 }
 
 
-bool ThinkerManager::hopefullyCurrentThreadIsNotThinker(
-    codeplace const & cp
-){
-    return hopefullyThreadIsNotThinker(*QThread::currentThread(), cp);
+void ThinkerManager::setExpiryTimeout(int milliseconds)
+{
+    hopefullyCurrentThreadIsManager(HERE);
+
+    _expiryTimeoutWasSet = true;
+    _expiryTimeout = milliseconds;
+
+    _executor->setExpiryTimeout(milliseconds);
+}
+
+
+int ThinkerManager::expiryTimeout() const
+{
+    return _executor->expiryTimeout();
+}
+
+
+void ThinkerManager::setThreadName(QString const & name)
+{
+    hopefullyCurrentThreadIsManager(HERE);
+
+    QMutexLocker lock (&_threadNameMutex);
+    _threadName = name;
+}
+
+
+QString ThinkerManager::threadName() const
+{
+    QMutexLocker lock (&_threadNameMutex);
+    return _threadName;
+}
+
+
+#if THINKERQT_USE_FIBERS
+
+void ThinkerManager::setFiberStackSize(std::size_t stackSize)
+{
+    hopefullyCurrentThreadIsManager(HERE);
+
+    _fiberStackSize = stackSize;
+}
+
+
+std::size_t ThinkerManager::fiberStackSize() const
+{
+    return _fiberStackSize;
+}
+
+#endif
+
+
+void ThinkerManager::setAbandonPolicy(AbandonPolicy policy)
+{
+    hopefullyCurrentThreadIsManager(HERE);
+
+    _abandonPolicy = policy;
+}
+
+
+ThinkerManager::AbandonPolicy ThinkerManager::abandonPolicy() const
+{
+    return _abandonPolicy;
 }
 
 
-bool ThinkerManager::hopefullyThreadIsThinker(
-    const QThread & thread,
+void ThinkerManager::applyAbandonPolicy(ThinkerPresentBase & present)
+{
+    if (_abandonPolicy != CancelAbandonedThinkers)
+        return;
+
+    // The sharing is only kept alive by the Presents that are parties to it,
+    // so it goes away with the last of them (and its hold on the thinker
+    // along with it)
+    //
+    present = make_shared<ThinkerSharing>(present)->join();
+}
+
+
+bool ThinkerManager::isThreadThinker(QThread const & thread)
+{
+    if (&thread == QThread::currentThread())
+        return isCurrentThreadThinker();
+
+    return maybeGetRunnerForThread(thread) != nullptr;
+}
+
+
+bool ThinkerManager::isCurrentThreadThinker()
+{
+    return maybeGetCurrentRunner() != nullptr;
+}
+
+
+void ThinkerManager::createRunnerForThinker(
+    shared_ptr<ThinkerBase> holder,
+    int priority,
+    ThinkerGroup * group,
     codeplace const & cp
 ){
-    return hopefully(maybeGetRunnerForThread(thread) != nullptr, cp);
+    hopefullyCurrentThreadIsManager(cp);
+
+    shared_ptr<ThinkerGroupControl> control;
+    if (group) {
+        hopefully(&group->getManager() == this, cp);
+        control = group->_control;
+    }
+
+    startRunner(holder, priority, control, cp);
 }
 
 
-bool ThinkerManager::hopefullyCurrentThreadIsThinker(
+shared_ptr<ThinkerBase> ThinkerManager::runContinuation(
+    unique_ptr<ThinkerBase> holder,
+    int priority,
     codeplace const & cp
 ){
-    return hopefullyThreadIsThinker(*QThread::currentThread(), cp);
+    hopefullyCurrentThreadIsNotThinker(cp);
+
+    shared_ptr<ThinkerBase> shared = holdThinker(std::move(holder), cp);
+
+    startRunner(shared, priority, nullptr, cp);
+
+    return shared;
 }
 
 
-void ThinkerManager::createRunnerForThinker(
+void ThinkerManager::startRunner(
     shared_ptr<ThinkerBase> holder,
+    int priority,
+    shared_ptr<ThinkerGroupControl> control,
     codeplace const & cp
 ){
-    hopefullyCurrentThreadIsManager(cp);
     hopefully(holder != nullptr, cp);
 
-    auto runner = make_shared<ThinkerRunner>(holder);
+    // Whatever thread we're on, the thinker has to live on it for us to be
+    // able to take its affinity away
+    //
+    hopefully(holder->thread() == QThread::currentThread(), cp);
+
+  #if THINKERQT_USE_FIBERS
+    auto runner = make_shared<ThinkerRunner>(
+        holder, priority, control, _fiberStackSize.load()
+    );
+  #else
+    auto runner = make_shared<ThinkerRunner>(holder, priority, control);
+  #endif
+
+    // Thinkers used to wait on a pool thread until the manager's event loop
+    // got around to pushing them onto it with moveToThread().  That meant a
+    // busy manager thread stalled every thinker start.  Instead we take away
+    // the thinker's thread affinity now; Qt allows an object that has none
+    // to be "pulled" onto whatever thread it is needed on, so the runner can
+    // attach it to the pool thread by itself.
+    //
+    holder->moveToThread(nullptr);
+
+    addToThinkerMap(runner);
 
     ThinkerRunnerProxy * proxy = new ThinkerRunnerProxy (runner);
 
@@ -152,14 +324,32 @@ void ThinkerManager::createRunnerForThinker(
     //
     proxy->setAutoDelete(true);
 
-    // QtConcurrent defines one global thread pool instance.  But maybe I'll
-    // let you specify your own, not sure if that's useful.  They make a lot
-    // of global assumptions, perhaps I should just piggy back on them.
+    queueRunner(proxy, priority);
+}
+
 
-    // Queue this runnable thing to the thread pool.  It may take a while
+void ThinkerManager::queueRunner(ThinkerRunnerProxy * proxy, int priority)
+{
+    // QtConcurrent defines one global thread pool instance, but sharing it
+    // means thinkers compete with unrelated work for threads.  So we queue
+    // this runnable thing on the manager's own executor.  It may take a while
     // before a thread gets allocated to it.
     //
-    static_cast<void>(QThreadPool::globalInstance()->start(proxy));
+    _executor->start(proxy, priority);
+}
+
+
+bool ThinkerManager::requeueRunner(ThinkerRunnerProxy * proxy, int priority)
+{
+    // tryTake() only succeeds if the proxy has not been picked up by a pool
+    // thread yet, and on success hands ownership back to us without running
+    // or deleting it...so we can put it back in at its new position.
+    //
+    if (not _executor->tryTake(proxy))
+        return false;
+
+    _executor->start(proxy, priority);
+    return true;
 }
 
 
@@ -169,7 +359,7 @@ void ThinkerManager::ensureThinkersPaused(codeplace const & cp)
 
     // we have to make a copy of the map
     //
-    QMutexLocker lock (&_mapsMutex);
+    QMutexLocker lock (&_thinkerMapMutex);
     auto mapCopy = _thinkerMap;
     lock.unlock();
 
@@ -195,25 +385,60 @@ void ThinkerManager::ensureThinkersResumed(codeplace const & cp)
 {
     hopefullyCurrentThreadIsNotThinker(HERE);
 
-    QMutexLocker lock (&_mapsMutex);
+    QMutexLocker lock (&_thinkerMapMutex);
+    auto mapCopy = _thinkerMap;
+    lock.unlock();
 
     // any thinkers that have not been aborted can be resumed
 
-    for (auto & runner : _thinkerMap) {
+    for (auto & runner : mapCopy) {
         if (runner->isPaused())
             runner->requestResumeButCanceledIsOkay(cp);
     }
 }
 
 
+ThinkerManager::ThreadMapShard & ThinkerManager::getThreadMapShard(
+    QThread const & thread
+){
+    // QThread objects are heap allocated, so the low bits of the address
+    // don't tell them apart much
+    //
+    quintptr bits = reinterpret_cast<quintptr>(&thread);
+    return _threadMapShards[(bits >> 6) % threadMapShardCount];
+}
+
+
+thread_local ThinkerRunner * ThinkerManager::_currentRunner = nullptr;
+
+
+ThinkerRunner * ThinkerManager::maybeGetCurrentRunner()
+{
+    // The pointer is per-thread but not per-manager, and a thread in some
+    // other manager's pool is not one of *our* thinkers
+    //
+    ThinkerRunner * runner = _currentRunner;
+    if (runner and (&runner->getManager() != this))
+        return nullptr;
+
+    return runner;
+}
+
+
 shared_ptr<ThinkerRunner> ThinkerManager::maybeGetRunnerForThread(
     const QThread & thread
 ){
-    QMutexLocker lock (&_mapsMutex);
+    if (&thread == QThread::currentThread()) {
+        ThinkerRunner * runner = maybeGetCurrentRunner();
+        if (not runner)
+            return nullptr;
+        return runner->shared_from_this();
+    }
 
-    shared_ptr<ThinkerRunner> result = _threadMap.value(&thread, nullptr);
+    ThreadMapShard & shard = getThreadMapShard(thread);
+    QMutexLocker lock (&shard.mutex);
 
-    return result;
+    return shard.map.value(&thread, nullptr);
 }
 
 
@@ -222,24 +447,49 @@ shared_ptr<ThinkerRunner> ThinkerManager::maybeGetRunnerForThinker(
 ){
     using State = ThinkerBase::State;
 
-    QMutexLocker lock (&_mapsMutex);
-
-    shared_ptr<ThinkerRunner> result = _thinkerMap.value(&thinker, nullptr);
-    if (not result) {
+    RunnerPin runner (thinker);
+    if (not runner) {
         hopefully(
             (thinker._state == State::ThinkerCanceled)
             or (thinker._state == State::ThinkerFinished),
             HERE
         );
+        return nullptr;
     }
 
-    return result;
+    return runner->shared_from_this();
+}
+
+
+ThinkerManager::RunnerPin::RunnerPin (ThinkerBase const & thinker) :
+    _thinker (thinker),
+    _runner (nullptr)
+{
+    // Both this and the manager's clearing of _runner in removeFromThinkerMap()
+    // are sequentially consistent.  So either we see null, or the manager
+    // sees our pin and waits for it.
+    //
+    _thinker._runnerPins.fetch_add(1);
+    _runner = _thinker._runner.load();
+}
+
+
+ThinkerManager::RunnerPin::~RunnerPin ()
+{
+    _thinker._runnerPins.fetch_sub(1);
 }
 
 
 const ThinkerBase * ThinkerManager::getThinkerForThreadMaybeNull(
     const QThread & thread
 ){
+    if (&thread == QThread::currentThread()) {
+        ThinkerRunner * runner = maybeGetCurrentRunner();
+        if (not runner)
+            return nullptr;
+        return &(runner->getThinker());
+    }
+
     shared_ptr<ThinkerRunner> runner = maybeGetRunnerForThread(thread);
     if (not runner)
         return nullptr;
@@ -266,6 +516,38 @@ void ThinkerManager::requestAndWaitForCancelButAlreadyCanceledIsOkay(
 }
 
 
+void ThinkerManager::requestCancelAsync(
+    ThinkerBase & thinker,
+    std::function<void()> onCanceled
+){
+    using State = ThinkerBase::State;
+
+    shared_ptr<ThinkerRunner> runner = maybeGetRunnerForThinker(thinker);
+    if (runner) {
+        runner->requestCancelButAlreadyCanceledIsOkay(HERE);
+
+        if (not onCanceled or runner->addCanceledCallback(onCanceled))
+            return;
+
+        // The runner was let go of between our lookup and now, and is past
+        // running callbacks.  Its state was made final before that, and its
+        // ended callbacks have acted on it, so it's left alone.
+    }
+    else {
+        // Finished before we got here, so the cancel only changes what the
+        // thinker reports, as with ThinkerPresentBase::cancel()
+        //
+        State finished = State::ThinkerFinished;
+        thinker._state.compare_exchange_strong(
+            finished, State::ThinkerCanceled
+        );
+    }
+
+    if (onCanceled)
+        QMetaObject::invokeMethod(this, onCanceled, Qt::QueuedConnection);
+}
+
+
 void ThinkerManager::ensureThinkerFinished(ThinkerBase & thinker)
 {
     using State = ThinkerBase::State;
@@ -317,15 +599,30 @@ void ThinkerManager::unlockThinker(ThinkerBase & thinker)
 
 void ThinkerManager::addToThinkerMap(shared_ptr<ThinkerRunner> runner)
 {
-    // We use a mutex to guard the addition and removal of Runners to the maps
     // If a Runner exists, then we look to its state information for
     // cancellation--not the Thinker.
 
-    QMutexLocker lock (&_mapsMutex);
-
     ThinkerBase & thinker = runner->getThinker();
+    hopefully(thinker._runner.load() == nullptr, HERE);
+
+    QMutexLocker lock (&_thinkerMapMutex);
+
     hopefully(not _thinkerMap.contains(&thinker), HERE);
     _thinkerMap.insert(&thinker, runner);
+    lock.unlock();
+
+    // The map owns the runner now, so it can be handed out
+    //
+    thinker._runner.store(runner.get());
+
+    // The group keeps its own map, so it doesn't have to go through ours
+    //
+    if (ThinkerGroupControl * control = runner->getGroupControl()) {
+        QMutexLocker groupLock (&control->mutex);
+
+        hopefully(not control->runners.contains(&thinker), HERE);
+        control->runners.insert(&thinker, runner);
+    }
 }
 
 
@@ -335,80 +632,99 @@ void ThinkerManager::removeFromThinkerMap(
 ){
     using State = ThinkerBase::State;
 
-    QMutexLocker lock (&_mapsMutex);
-
     ThinkerBase & thinker = runner->getThinker();
-    hopefully(_thinkerMap.remove(&thinker) == 1, HERE);
 
+    // A cancel can turn a Finished runner into a Canceled one even after it
+    // has returned from runThinker(), and then the canceler is owed a
+    // canceled thinker
+    //
+    if (runner->isCanceled())
+        wasCanceled = true;
+
+    // The state has to be in place before anyone can see the runner gone
+    //
     hopefully(thinker._state == State::ThinkerOwnedByRunner, HERE);
     thinker._state = wasCanceled
         ? State::ThinkerCanceled
         : State::ThinkerFinished;
-}
 
+    thinker._runner.store(nullptr);
 
-void ThinkerManager::addToThreadMap(
-    shared_ptr<ThinkerRunner> runner,
-    QThread & thread
-){
-    QMutexLocker lock (&_mapsMutex);
+    // Anyone who got the pointer before it was cleared is done with it once
+    // they unpin, and that's never long
+    //
+    while (thinker._runnerPins.load() != 0)
+        QThread::yieldCurrentThread();
 
-    hopefully(&thread != this->thread(), HERE);
+    // Canceled callbacks are only added after a cancel request, so a runner
+    // that wasn't canceled has none.  Taking them stops any more being added,
+    // and whoever tries then sees the state we just set.
+    //
+    QList<std::function<void()>> callbacks = runner->takeCanceledCallbacks();
+    QList<std::function<void()>> continuations = runner->takeEndedCallbacks();
+    if (wasCanceled) {
+        for (std::function<void()> & callback : callbacks)
+            QMetaObject::invokeMethod(this, callback, Qt::QueuedConnection);
 
-    hopefully(not _threadMap.contains(&thread), HERE);
-    _threadMap.insert(&thread, runner);
-}
+        emit thinker.canceled();
+    }
 
+    if (ThinkerGroupControl * control = runner->getGroupControl()) {
+        QMutexLocker groupLock (&control->mutex);
 
-void ThinkerManager::removeFromThreadMap(
-    shared_ptr<ThinkerRunner> runner,
-    QThread & thread
-){
-    Q_UNUSED(runner)
+        int removed = control->runners.remove(&thinker);
+        hopefully(removed == 1, HERE);
+        control->changed.wakeAll();
+    }
 
-    QMutexLocker lock (&_mapsMutex);
+    {
+        QMutexLocker lock (&_thinkerMapMutex);
 
-    hopefully(_threadMap.remove(&thread) == 1, HERE);
+        int removed = _thinkerMap.remove(&thinker);
+        hopefully(removed == 1, HERE);
+    }
+
+    // We're on the pool thread, which has let go of the runner already, so
+    // any thinkers that come next can be started right here (see
+    // ThinkerPresentBase::whenEnded())
+    //
+    for (std::function<void()> & continuation : continuations)
+        continuation();
 }
 
 
-void ThinkerManager::waitForPushToThread(ThinkerRunner * runner)
-{
-    hopefullyCurrentThreadIsThinker(HERE);
+void ThinkerManager::addToThreadMap(
+    shared_ptr<ThinkerRunner> runner,
+    QThread & thread
+){
+    hopefully(&thread != this->thread(), HERE);
+    hopefully(&thread == QThread::currentThread(), HERE);
+
+    hopefully(_currentRunner == nullptr, HERE);
+    _currentRunner = runner.get();
 
-    QMutexLocker lock (&_pushThreadMutex);
+    ThreadMapShard & shard = getThreadMapShard(thread);
+    QMutexLocker lock (&shard.mutex);
 
-    _runnerSetToPush.insert(runner);
-    _threadsNeedPushing.wakeOne();
-    emit pushToThreadMayBeNeeded();
-    _threadsWerePushed.wait(&_pushThreadMutex);
+    hopefully(not shard.map.contains(&thread), HERE);
+    shard.map.insert(&thread, runner);
 }
 
 
-void ThinkerManager::processThreadPushesUntil(ThinkerRunner * runner)
-{
-    hopefullyCurrentThreadIsNotThinker(HERE);
+void ThinkerManager::removeFromThreadMap(
+    shared_ptr<ThinkerRunner> runner,
+    QThread & thread
+){
+    hopefully(&thread == QThread::currentThread(), HERE);
 
-    QMutexLocker lock (&_pushThreadMutex);
-    forever {
-        bool found = false;
-        for (ThinkerRunner * runnerToPush : _runnerSetToPush) {
-            runnerToPush->doThreadPushIfNecessary();
-            if (runner and (runnerToPush == runner))
-                found = true;
-        }
-        _runnerSetToPush.clear();
-        _threadsWerePushed.wakeAll();
-        if (found or not runner)
-            return;
-        _threadsNeedPushing.wait(&_pushThreadMutex);
-    }
-}
+    hopefully(_currentRunner == runner.get(), HERE);
+    _currentRunner = nullptr;
 
+    ThreadMapShard & shard = getThreadMapShard(thread);
+    QMutexLocker lock (&shard.mutex);
 
-void ThinkerManager::doThreadPushesIfNecessary()
-{
-    processThreadPushesUntil(nullptr);
+    int removed = shard.map.remove(&thread);
+    hopefully(removed == 1, HERE);
 }
 
 
@@ -419,17 +735,15 @@ ThinkerManager::~ThinkerManager ()
     // We catch you with an assertion if you do not make sure all your
     // Presents have been either canceled or completed
     //
-    bool anyRunners = false;
-
     {
-        QMutexLocker lock (&_mapsMutex);
+        QMutexLocker lock (&_thinkerMapMutex);
 
-        for (shared_ptr<ThinkerRunner> runner : _thinkerMap) {
+        for (shared_ptr<ThinkerRunner> runner : _thinkerMap)
             hopefully(runner->isCanceled() or runner->isFinished(), HERE);
-            anyRunners = true;
-        }
     }
 
-    if (anyRunners)
-        QThreadPool::globalInstance()->waitForDone();
+    // Only our own executor needs to drain; work that other code has put on
+    // QThreadPool::globalInstance() is none of our business
+    //
+    _executor->waitForDone();
 }
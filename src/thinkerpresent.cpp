@@ -22,10 +22,12 @@
 #include "thinkerqt/thinkerrunner.h"
 #include "thinkerqt/thinkerpresent.h"
 #include "thinkerqt/thinkermanager.h"
+#include "thinkerqt/thinkerinterest.h"
 
 
 ThinkerPresentBase::ThinkerPresentBase () :
     _holder (nullptr),
+    _interest (),
     _thread (QThread::currentThread())
 {
 }
@@ -35,6 +37,7 @@ ThinkerPresentBase::ThinkerPresentBase (
     ThinkerPresentBase const & other
 ) :
     _holder (other._holder),
+    _interest (other._interest),
     _thread (QThread::currentThread())
 {
 }
@@ -44,6 +47,7 @@ ThinkerPresentBase::ThinkerPresentBase (
     shared_ptr<ThinkerBase> _holder
 ) :
     _holder (_holder),
+    _interest (),
     _thread (QThread::currentThread())
 {
 }
@@ -70,29 +74,31 @@ ThinkerPresentBase & ThinkerPresentBase::operator= (
 ){
     if (this != &other) {
         _holder = other._holder;
+        _interest = other._interest;
     }
     return *this;
 }
 
 
-bool ThinkerPresentBase::hopefullyCurrentThreadIsDifferent(
-    codeplace const & cp
-) const
+shared_ptr<ThinkerSharing> ThinkerPresentBase::getSharing() const
+{
+    if (not _interest)
+        return nullptr;
+
+    return _interest->getSharing();
+}
+
+
+bool ThinkerPresentBase::isCurrentThreadDifferent() const
 {
-    // The primary restriction on communicating with a thinker with a
-    // Present or a PresentWatcher is that we are not doing so on
-    // the same thread that the Thinker itself is running on.  We
-    // can take snapshots and such from pretty much any other thread
-    // in the system.
-    //
     if (not _holder)
         return true;
 
-    auto runner = _holder->_mgr.maybeGetRunnerForThinker(*_holder);
+    ThinkerManager::RunnerPin runner (*_holder);
     if (not runner)
         return true;
 
-    return runner->hopefullyCurrentThreadIsNotThinker(cp);
+    return not _holder->_mgr.isCurrentThreadThinker();
 }
 
 
@@ -121,9 +127,9 @@ bool ThinkerPresentBase::isCanceled() const
         return true;
 
     ThinkerBase const & thinker = getThinkerBase();
-    auto runner = thinker.getManager().maybeGetRunnerForThinker(thinker);
+    ThinkerManager::RunnerPin runner (thinker);
     bool result = false;
-    if (runner == nullptr)
+    if (not runner)
         result = (thinker._state == State::ThinkerCanceled);
     else
         result = runner->isCanceled();
@@ -144,9 +150,9 @@ bool ThinkerPresentBase::isFinished() const
     }
 
     ThinkerBase const & thinker = getThinkerBase();
-    auto runner = thinker.getManager().maybeGetRunnerForThinker(thinker);
+    ThinkerManager::RunnerPin runner (thinker);
     bool result = false;
-    if (runner == nullptr)
+    if (not runner)
         result = (thinker._state == State::ThinkerFinished);
     else
         result = runner->isFinished();
@@ -163,9 +169,9 @@ bool ThinkerPresentBase::isPaused() const
         return false;  // !!! This return statement was commented out.  Why?
 
     ThinkerBase const & thinker = getThinkerBase();
-    auto runner = thinker.getManager().maybeGetRunnerForThinker(thinker);
+    ThinkerManager::RunnerPin runner (thinker);
     bool result = false;
-    if (runner != nullptr)  // nullptr means thinker finished or was canceled
+    if (runner)  // nullptr means thinker finished or was canceled
         result = runner->isPaused();
 
     return result;
@@ -184,6 +190,14 @@ void ThinkerPresentBase::cancel()
     if (not _holder)
         return;
 
+    // Others may still want a thinker we share; it's canceled when the last
+    // party withdraws
+    //
+    if (_interest) {
+        _interest->withdraw();
+        return;
+    }
+
     ThinkerBase & thinker (getThinkerBase());
     auto runner = thinker.getManager().maybeGetRunnerForThinker(thinker);
     if (runner == nullptr)
@@ -199,6 +213,44 @@ void ThinkerPresentBase::cancel()
 }
 
 
+void ThinkerPresentBase::cancelAsync(std::function<void()> onCanceled)
+{
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (not _holder) {
+        //
+        // As with cancel(), an empty Present counts as already canceled
+        //
+      #ifdef THINKERQT_EXPLICIT_MANAGER
+        hopefully(not onCanceled, HERE);  // no manager to call back on
+      #else
+        if (onCanceled) {
+            QMetaObject::invokeMethod(
+                &ThinkerManager::getGlobalManager(),
+                onCanceled,
+                Qt::QueuedConnection
+            );
+        }
+      #endif
+        return;
+    }
+
+    if (_interest) {
+        //
+        // As with cancel(), the thinker may go on for the sake of others.
+        // Then there's no telling when it will be canceled (if ever), so
+        // there is nothing to call back about.
+        //
+        hopefully(not onCanceled, HERE);
+        _interest->withdraw();
+        return;
+    }
+
+    ThinkerBase & thinker (getThinkerBase());
+    thinker.getManager().requestCancelAsync(thinker, onCanceled);
+}
+
+
 void ThinkerPresentBase::pause()
 {
     hopefullyCurrentThreadIsDifferent(HERE);
@@ -259,6 +311,36 @@ void ThinkerPresentBase::togglePaused() {
 }
 
 
+void ThinkerPresentBase::setPriority(int priority)
+{
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (not _holder)
+        return;
+
+    ThinkerBase & thinker (getThinkerBase());
+    auto runner = thinker.getManager().maybeGetRunnerForThinker(thinker);
+    if (runner != nullptr)  // null means finished or canceled
+        runner->setPriority(priority, HERE);
+}
+
+
+int ThinkerPresentBase::priority() const
+{
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (not _holder)
+        return ThinkerManager::NormalPriority;
+
+    ThinkerBase const & thinker = getThinkerBase();
+    auto runner = thinker.getManager().maybeGetRunnerForThinker(thinker);
+    if (runner == nullptr)
+        return ThinkerManager::NormalPriority;
+
+    return runner->priority();
+}
+
+
 void ThinkerPresentBase::waitForFinished()
 {
     hopefullyCurrentThreadIsDifferent(HERE);
@@ -277,6 +359,81 @@ void ThinkerPresentBase::waitForFinished()
 }
 
 
+void ThinkerPresentBase::whenEnded(
+    std::function<void(ThinkerPresentBase &)> callback
+){
+    hopefullyCurrentThreadIsDifferent(HERE);
+    hopefully(_holder != nullptr, HERE);
+
+    // Not a copy of this Present, as a callback that's waiting shouldn't
+    // count as an interest in the thinker (see ThinkerSharing).  It is made
+    // when the callback runs, because a Present has to be destroyed on the
+    // thread it was made on and this one is likely to end on a pool thread.
+    //
+    shared_ptr<ThinkerBase> holder = _holder;
+
+    std::function<void()> continuation = [holder, callback]() {
+        ThinkerPresentBase ended (holder);
+        callback(ended);
+    };
+
+    ThinkerManager & mgr = _holder->getManager();
+    auto runner = mgr.maybeGetRunnerForThinker(*_holder);
+    if (runner != nullptr and runner->addEndedCallback(continuation))
+        return;
+
+    // The manager has let go of the runner, so the thinker is as finished
+    // (or canceled) as it will ever be
+    //
+    continuation();
+}
+
+
+void ThinkerPresentBase::thenBase(
+    std::function<unique_ptr<ThinkerBase>(ThinkerPresentBase &)> makeNext,
+    std::function<void(ThinkerPresentBase &)> started,
+    int priority
+){
+    hopefully(_holder != nullptr, HERE);
+
+    ThinkerManager & mgr = getThinkerBase().getManager();
+
+    whenEnded([&mgr, makeNext, started, priority](
+        ThinkerPresentBase & previous
+    ){
+        if (previous.isCanceled())
+            return;
+
+        unique_ptr<ThinkerBase> next = makeNext(previous);
+        if (not next)
+            return;  // the factory decided to stop here
+
+        shared_ptr<ThinkerBase> holder = mgr.runContinuation(
+            std::move(next), priority, HERE
+        );
+
+        // A Present made here would be stuck on this pool thread, and whoever
+        // wants to keep it is on some other thread.  So it's made on the
+        // manager thread and handed over there, as canceled callbacks are.
+        //
+        QMetaObject::invokeMethod(&mgr, [&mgr, holder, started]() {
+            ThinkerPresentBase present (holder);
+            mgr.applyAbandonPolicy(present);
+            if (started)
+                started(present);
+        }, Qt::QueuedConnection);
+    });
+}
+
+
+void ThinkerPresentBase::thenBase(
+    std::function<unique_ptr<ThinkerBase>(ThinkerPresentBase &)> makeNext,
+    std::function<void(ThinkerPresentBase &)> started
+){
+    thenBase(makeNext, started, ThinkerManager::NormalPriority);
+}
+
+
 SnapshotBase * ThinkerPresentBase::createSnapshotBase() const
 {
     hopefullyCurrentThreadIsDifferent(HERE);
@@ -287,6 +444,57 @@ SnapshotBase * ThinkerPresentBase::createSnapshotBase() const
 }
 
 
+#if OFFER_PROGRESS_API_LIKE_QFUTURE
+
+int ThinkerPresentBase::progressMaximum() const
+{
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (not _holder)
+        return 0;
+
+    return getThinkerBase()._progressMaximum.load();
+}
+
+
+int ThinkerPresentBase::progressMinimum() const
+{
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (not _holder)
+        return 0;
+
+    return getThinkerBase()._progressMinimum.load();
+}
+
+
+QString ThinkerPresentBase::progressText() const
+{
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (not _holder)
+        return QString ();
+
+    shared_ptr<QString const> text
+        = std::atomic_load(&getThinkerBase()._progressText);
+
+    return text ? *text : QString ();
+}
+
+
+int ThinkerPresentBase::progressValue() const
+{
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (not _holder)
+        return 0;
+
+    return getThinkerBase()._progressValue.load();
+}
+
+#endif
+
+
 ThinkerPresentBase::~ThinkerPresentBase ()
 {
     hopefully(QThread::currentThread() == _thread, HERE);
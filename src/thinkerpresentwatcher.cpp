@@ -26,7 +26,8 @@
 ThinkerPresentWatcherBase::ThinkerPresentWatcherBase () :
     _present (),
     _milliseconds (200),  // !!! is 200 msec a good default?
-    _notificationThrottler ()
+    _notificationThrottler (),
+    _progressThrottler ()
 {
     hopefullyCurrentThreadIsDifferent(HERE);
 }
@@ -37,7 +38,8 @@ ThinkerPresentWatcherBase::ThinkerPresentWatcherBase (
 ) :
     _present (present),
     _milliseconds (200),  // !!! is 200 msec a good default?
-    _notificationThrottler ()
+    _notificationThrottler (),
+    _progressThrottler ()
 {
     hopefullyCurrentThreadIsDifferent(HERE);
     doConnections();
@@ -79,12 +81,32 @@ void ThinkerPresentWatcherBase::doConnections()
             Qt::AutoConnection
         );
 
+        // Progress gets a throttler of its own, so a thinker that reports
+        // progress far more often than it writes doesn't hold back written()
+        // (or the other way around)
+        //
+        _progressThrottler = QSharedPointer<SignalThrottler>(
+            new SignalThrottler (_milliseconds, this)
+        );
+
+        connect(
+            _progressThrottler.data(), &SignalThrottler::throttled,
+            this, &ThinkerPresentWatcherBase::progressChanged,
+            Qt::AutoConnection
+        );
+
         connect(
             &_present.getThinkerBase(), &ThinkerBase::done,
             this, &ThinkerPresentWatcherBase::finished,
             Qt::AutoConnection
         );
 
+        connect(
+            &_present.getThinkerBase(), &ThinkerBase::canceled,
+            this, &ThinkerPresentWatcherBase::canceled,
+            Qt::AutoConnection
+        );
+
         // add to the new watch list.  note that we may have missed the
         // "finished" signal so if it has finished, you will get an artificial
         // "finished" re-broadcast
@@ -109,9 +131,11 @@ void ThinkerPresentWatcherBase::doDisconnections() {
         ThinkerBase & thinker = this->_present.getThinkerBase();
 
         QWriteLocker lock (&thinker._watchersLock);
-        hopefully(thinker._watchers.remove(this), HERE);
+        bool removed = thinker._watchers.remove(this);
+        hopefully(removed, HERE);
 
         _notificationThrottler = QSharedPointer<SignalThrottler>();
+        _progressThrottler = QSharedPointer<SignalThrottler>();
     }
 }
 
@@ -146,6 +170,8 @@ void ThinkerPresentWatcherBase::setThrottleTime(unsigned int milliseconds)
     this->_milliseconds = milliseconds;
     if (_notificationThrottler)
         _notificationThrottler->setMillisecondsDefault(milliseconds);
+    if (_progressThrottler)
+        _progressThrottler->setMillisecondsDefault(milliseconds);
 }
 
 
@@ -20,38 +20,12 @@
 //
 
 #include <QMutexLocker>
+#include <QElapsedTimer>
 
 #include "thinkerqt/thinkerrunner.h"
 #include "thinkerqt/thinkermanager.h"
 
 
-// operator<< for ThinkerRunner::State
-//
-// Required by tracked<T> because it must be able to present a proper debug
-// message about the tracked value.
-
-inline QTextStream & operator<< (
-    QTextStream & o,
-    ThinkerRunner::State const & state
-){
-    using State = ThinkerRunner::State;
-
-    QMap<State, const char*> m = {
-        {State::Queued, "Queued"},
-        {State::QueuedButPaused, "QueuedButPaused"},
-        {State::ThreadPush, "ThreadPush"},
-        {State::Thinking, "Thinking"},
-        {State::Pausing, "Pausing"},
-        {State::Paused, "Paused"},
-        {State::Resuming, "Resuming"},
-        {State::Finished, "Finished"},
-        {State::Canceling, "Canceling"},
-        {State::Canceled, "Canceled"}
-    };
-    return o << "ThinkerRunner::State::" << m[state];
-}
-
-
 //
 // ThinkerRunnerHelper
 //
@@ -77,20 +51,29 @@ void ThinkerRunnerHelper::markFinished()
 
     hopefullyCurrentThreadIsRun(HERE);
 
-    QMutexLocker lock (&_runner._stateMutex);
+    State state = _runner.state();
+    while (true) {
+        if ((state == State::Canceling) or (state == State::Canceled)) {
+            //
+            // we don't let it transition to finished if abort is requested
+            // (a fiber paused in place goes straight to Canceled, and then
+            // gets resumed to unwind--which may still end up emitting done())
+            //
+            return;
+        }
 
-    if (_runner._state == State::Canceling) {
-        //
-        // we don't let it transition to finished if abort is requested
-        //
-    } else {
-        _runner._state.hopefullyInSet(
-            State::Thinking, State::Pausing,
+        hopefully(
+            ThinkerRunner::stateIn(state, State::Thinking, State::Pausing),
             HERE
         );
-        _runner._state.hopefullyAlter(State::Finished, HERE);
-        _runner._stateWasChanged.wakeOne();
-        _runner.quit();
+
+        // A cancel request may slip in while we're doing this; if so, the
+        // exchange fails and we go around again to see the new state
+        //
+        if (_runner.compareAndSwapState(state, State::Finished)) {
+            _runner.quit();
+            return;
+        }
     }
 }
 
@@ -106,22 +89,47 @@ ThinkerRunnerHelper::~ThinkerRunnerHelper ()
 // ThinkerRunner
 //
 
-ThinkerRunner::ThinkerRunner (shared_ptr<ThinkerBase> holder) :
+ThinkerRunner::ThinkerRunner (
+    shared_ptr<ThinkerBase> holder,
+    int priority,
+    shared_ptr<ThinkerGroupControl> group,
+    std::size_t fiberStackSize
+) :
     QEventLoop (),
-    _state (State::Queued, HERE),
+    _state (State::Queued),
+    _waiters (0),
+    _stopRequested (false),
     _holder (holder),
-    _helper ()
+    _helper (),
+    _group (group),
+    _proxy (nullptr),
+    _priority (priority),
+    _canceledCallbacks (),
+    _canceledCallbacksTaken (false),
+    _endedCallbacks (),
+    _endedCallbacksTaken (false),
+    _originalThread (holder->getManager().thread())
+  #if THINKERQT_USE_FIBERS
+    ,
+    _fiberStackSize (fiberStackSize),
+    _fiber (),
+    _fiberWasCanceled (false),
+    _fiberParked (false)
+  #endif
 {
     hopefully(_holder != nullptr, HERE);
 
-    // need to check this, because we will later ask the manager to move the
-    // Thinker to the thread of the QRunnable (when we find out what that
-    // thread is; we don't know until the Thread Pool decides to run this).
-    //
-    // Must ask the manager thread because we can only push from a thread,
-    // not pull onto an arbitrary one...
+  #if !THINKERQT_USE_FIBERS
+    hopefully(fiberStackSize == 0, HERE);
+  #endif
+
+    // need to check this, because the manager is about to take away the
+    // Thinker's thread affinity (so the pool thread can pull it over when
+    // we find out what that thread is).  We only push it back to the
+    // manager's thread once we are done.  You can only give away an object
+    // from the thread it lives on.
     
-    hopefullyCurrentThreadIsManager(HERE);
+    hopefullyCurrentThreadIsNotThinker(HERE);
     hopefully(getThinker().thread() == QThread::currentThread(), HERE);
 
     // Formerly this code would use a queued connection to get a paused thinker
@@ -141,75 +149,276 @@ ThinkerRunner::ThinkerRunner (shared_ptr<ThinkerBase> holder) :
 }
 
 
-bool ThinkerRunner::hopefullyCurrentThreadIsNotThinker(
-    codeplace const & cp
-) const
+ThinkerManager & ThinkerRunner::getManager() const
 {
-    return getManager().hopefullyCurrentThreadIsNotThinker(cp);
+    return getThinker().getManager();
 }
 
 
-bool ThinkerRunner::hopefullyCurrentThreadIsManager(
-    codeplace const & cp
-) const
+ThinkerBase const & ThinkerRunner::getThinker () const
 {
-    return getManager().hopefullyCurrentThreadIsManager(cp);
+    return *_holder;
 }
 
 
+ThinkerBase & ThinkerRunner::getThinker ()
+{
+    return *_holder;
+}
 
-bool ThinkerRunner::hopefullyCurrentThreadIsRun(
-    codeplace const & cp
-) const
+
+//
+// State transitions are all made with a compare-and-swap on the atomic
+// _state, so checking it (which the thinker does constantly, and the GUI
+// does whenever it likes) never needs a lock.  The mutex and wait condition
+// only come into play when someone actually has to block until the state
+// changes.  They announce that in _waiters, and only if it is nonzero does
+// a successful transition bother to take the mutex and wake them.
+//
+// (The waiter increments _waiters before checking the state, and the
+// changer swaps the state before checking _waiters.  These are sequentially
+// consistent, so at least one of the two sides sees the other's write.)
+//
+
+bool ThinkerRunner::compareAndSwapState(State & expected, State desired)
 {
-    hopefully(_helper, cp);
-    return _helper->hopefullyCurrentThreadIsRun(cp);
+    if (not _state.compare_exchange_strong(
+        expected, desired, std::memory_order_seq_cst
+    )){
+        return false;
+    }
+
+    if (_waiters.load(std::memory_order_seq_cst) != 0) {
+        QMutexLocker lock (&_stateMutex);
+        _stateWasChanged.wakeAll();
+    }
+    return true;
 }
 
 
-ThinkerManager & ThinkerRunner::getManager() const
+bool ThinkerRunner::tryTransition(State from, State to)
 {
-    return getThinker().getManager();
+    return compareAndSwapState(from, to);
 }
 
 
-ThinkerBase const & ThinkerRunner::getThinker () const
+void ThinkerRunner::transition(State from, State to, codeplace const & cp)
 {
-    return *_holder;
+    bool transitioned = tryTransition(from, to);
+    hopefully(transitioned, cp);
 }
 
 
-ThinkerBase & ThinkerRunner::getThinker ()
+bool ThinkerRunner::waitForStateChange(State from, unsigned long time) const
 {
-    return *_holder;
+    if (_state.load(std::memory_order_acquire) != from)
+        return true;
+
+    _waiters.fetch_add(1, std::memory_order_seq_cst);
+
+    QElapsedTimer timer;
+    if (time != ULONG_MAX)
+        timer.start();
+
+    bool changed = true;
+    {
+        QMutexLocker lock (&_stateMutex);
+
+        while (_state.load(std::memory_order_seq_cst) == from) {
+            unsigned long remaining = time;
+            if (time != ULONG_MAX) {
+                qint64 elapsed = timer.elapsed();
+                if (elapsed >= static_cast<qint64>(time)) {
+                    changed = false;
+                    break;
+                }
+                remaining = time - static_cast<unsigned long>(elapsed);
+            }
+            _stateWasChanged.wait(&_stateMutex, remaining);
+        }
+    }
+
+    _waiters.fetch_sub(1, std::memory_order_seq_cst);
+    return changed;
 }
 
 
-void ThinkerRunner::doThreadPushIfNecessary ()
+void ThinkerRunner::sleepWhilePaused(State paused)
 {
-    hopefullyCurrentThreadIsManager(HERE);
+    hopefully(stateIn(paused, State::Paused, State::QueuedButPaused), HERE);
 
-    QMutexLocker lock (&_stateMutex);
+  #if THINKERQT_USE_FIBERS
+    if (isOnFiber()) {
+        //
+        // Objects can only be pulled onto a thread if they have no affinity,
+        // and we don't know what thread will pick the fiber back up.  So let
+        // go of the thinker (and the helper) before switching out.
+        //
+        bool attached = (getThinker().thread() != nullptr);
+        if (attached) {
+            if (_helper)
+                _helper->moveToThread(nullptr);
+            getThinker().moveToThread(nullptr);
+        }
 
-    if (_state == State::ThreadPush) {
-        hopefully(_helper, HERE);
-        getThinker().moveToThread(_helper->thread());
-        _state.hopefullyAlter(State::Thinking, HERE);
-        _stateWasChanged.wakeOne();
+        _fiber->suspend();
+
+        {
+            // A new proxy requeued us, and it's done its job
+            //
+            QMutexLocker lock (&_stateMutex);
+            _proxy = nullptr;
+        }
+
+        if (attached) {
+            getThinker().moveToThread(QThread::currentThread());
+            if (_helper)
+                _helper->moveToThread(QThread::currentThread());
+        }
+        return;
     }
+  #endif
+
+    static_cast<void>(waitForStateChange(paused));
 }
 
 
-bool ThinkerRunner::runThinker ()
+//
+// Group pause never touches the members' states.  The group just makes its
+// epoch odd, and members notice that when they poll and wait on the group's
+// condition until it's even again.  Everything but the thinker's polling is
+// done with the group's mutex held, which is what lets waitForPause() trust
+// the running count: a member entering can't miss a pause that is already
+// counting on it not to.
+//
+
+void ThinkerRunner::joinGroupRunning()
+{
+    if (not _group)
+        return;
+
+    QMutexLocker lock (&_group->mutex);
+    _group->running++;
+}
+
+
+void ThinkerRunner::leaveGroupRunning()
+{
+    if (not _group)
+        return;
+
+    QMutexLocker lock (&_group->mutex);
+    hopefully(_group->running > 0, HERE);
+    if (--_group->running == 0)
+        _group->changed.wakeAll();
+}
+
+
+void ThinkerRunner::sleepWhileGroupPaused()
 {
-    _stateMutex.lock();
+    if (not _group)
+        return;
+
+    QMutexLocker lock (&_group->mutex);
 
-    if (_state == State::QueuedButPaused) {
-        _stateWasChanged.wait(&_stateMutex);
+    // A pause or cancel of this member in particular has to be seen by the
+    // thinker's own code, so it ends the wait too (see wakeGroup())
+    //
+    unsigned epoch;
+    while (
+        ((epoch = _group->epoch.load(std::memory_order_relaxed)) & 1)
+        and (state() == State::Thinking)
+    ){
+        if (--_group->running == 0)
+            _group->changed.wakeAll();
+
+        while (
+            (_group->epoch.load(std::memory_order_relaxed) == epoch)
+            and (state() == State::Thinking)
+        ){
+            _group->changed.wait(&_group->mutex);
+        }
+
+        _group->running++;
     }
-    _state.hopefullyInSet(State::Queued, State::Canceled, HERE);
+}
+
+
+void ThinkerRunner::wakeGroup()
+{
+    if (not _group)
+        return;
+
+    QMutexLocker lock (&_group->mutex);
+    _group->changed.wakeAll();
+}
+
+
+#if THINKERQT_USE_FIBERS
+
+bool ThinkerRunner::isOnFiber() const
+{
+    return _fiber and (ThinkerFiber::current() == _fiber.get());
+}
+
+
+void ThinkerRunner::fiberSuspended()
+{
+    // The state may have changed after sleepWhilePaused() checked it but
+    // before the fiber finished switching out.  Whoever changed it could not
+    // have requeued us then (we weren't parked yet), so we do it.  The
+    // exchange in unparkFiberIfNecessary() makes sure only one side does.
+    //
+    _fiberParked.store(true, std::memory_order_seq_cst);
+
+    State state = _state.load(std::memory_order_seq_cst);
+    if (not stateIn(state, State::Paused, State::QueuedButPaused))
+        unparkFiberIfNecessary();
+}
+
+
+void ThinkerRunner::unparkFiberIfNecessary()
+{
+    if (_fiberParked.exchange(false, std::memory_order_seq_cst))
+        requeueFiber();
+}
+
+
+void ThinkerRunner::requeueFiber()
+{
+    // The proxy's constructor takes the mutex to point us at it.  A
+    // setPriority() in between can't requeue it yet, but it leaves the new
+    // priority for us to queue it with.
+    //
+    ThinkerRunnerProxy * proxy = new ThinkerRunnerProxy (shared_from_this());
+    proxy->setAutoDelete(true);
+
+    QMutexLocker lock (&_stateMutex);
+    getManager().queueRunner(proxy, _priority);
+}
 
-    if (_state == State::Queued) {
+#endif
+
+
+bool ThinkerRunner::runThinker ()
+{
+    {
+        // We're off the pool's queue now, so there's nothing left to reorder
+        //
+        QMutexLocker lock (&_stateMutex);
+        _proxy = nullptr;
+    }
+
+    while (state() == State::QueuedButPaused)
+        sleepWhilePaused(State::QueuedButPaused);
+
+    // The manager left the Thinker without any thread affinity, which is the
+    // one case in which Qt lets us pull an object onto the current thread.
+    // No round trip to the manager thread is needed.
+    //
+    getThinker().moveToThread(QThread::currentThread());
+
+    if (state() != State::Canceled) {
         //
         // Create from within the thread's run() in order to make sure that
         // our helper object has the thread affinity of the new executing
@@ -229,37 +438,49 @@ bool ThinkerRunner::runThinker ()
             _helper.data(), &ThinkerRunnerHelper::markFinished,
             Qt::DirectConnection
         );
+    }
 
-        QThread * originalThinkerThread = getThinker().thread();
+    // We can be paused (again) or canceled right up until we get the state
+    // swapped to Thinking
+    //
+    State state = State::Queued;
+    while (not compareAndSwapState(state, State::Thinking)) {
+        if (state == State::Canceled)
+            break;
+        sleepWhilePaused(state);
+        state = State::Queued;
+    }
 
-        // Now that we know what thread the Thinker will be running on, we ask
-        // the main thread to push it onto our current thread allocated to us
-        // by the pool
+    if (state == State::Canceled)
+        _helper.clear();
+    else {
+        // If our group is paused, we wait here so the thinker doesn't start
         //
-        _state.hopefullyAlter(State::ThreadPush, HERE);
-        _stateWasChanged.wakeOne();
-        _stateMutex.unlock();
+        joinGroupRunning();
+        sleepWhileGroupPaused();
 
-        getManager().waitForPushToThread(this);
-
-        // There are two places where the object will be pushed.  One is from
-        // the event loop if the signal happens.  But if before that can happen
-        // any of our code gets called from the manager thread then we'll
-        // preempt that.
+        // Requests from the manager thread can come in as soon as we are
+        // Thinking, before the thinker ever gets to start().
         //
-        _stateMutex.lock();
-        _state.hopefullyInSet(
-            State::Thinking, State::Canceling, State::Pausing, HERE
+        state = this->state();
+        hopefully(
+            stateIn(state, State::Thinking, State::Canceling, State::Pausing),
+            HERE
         );
-        bool didCancelOrFinish = (_state == State::Canceling);
-        bool skipToPause = (_state == State::Pausing);
-        _stateMutex.unlock();
+        bool didCancelOrFinish = (state == State::Canceling);
+        bool skipToPause = (state == State::Pausing);
 
         hopefully(getThinker().thread() == QThread::currentThread(), HERE);
 
-        // TODO: will it be possible to use resumable coroutines so that an
-        // idle thinker which is waiting for a message could delegate some time
-        // to another thinker?
+        getThinker()._stopRequested = &_stopRequested;
+        getThinker()._groupEpoch = _group ? &_group->epoch : nullptr;
+
+        // When built with THINKERQT_USE_FIBERS and the manager has a fiber
+        // stack size set, we are on a ThinkerFiber here.  Then a pause
+        // request suspends the thinker inside wasPauseRequested() and lets
+        // another thinker have this pool thread.  (Note afterThreadAttach()
+        // and beforeThreadDetach() are only called once, even though the
+        // thinker may be moved between several threads in the meantime.)
         //
         getThinker().afterThreadAttach();
 
@@ -303,30 +524,42 @@ bool ThinkerRunner::runThinker ()
             // with a "Canceled" transition if the work the thinker has done
             // was invalidated
 
-            _stateMutex.lock();
+            state = this->state();
+            while (true) {
+                if (
+                    (state == State::Finished)
+                    or (state == State::Canceled)  // fiber canceled in place
+                ){
+                    didCancelOrFinish = true;
+                    break;
+                }
 
-            if (_state == State::Finished)
-                didCancelOrFinish = true;
-            else if (_state == State::Canceling) {
-                _state.hopefullyTransition(
-                    State::Canceling, State::Canceled, HERE
-                );
-                _stateWasChanged.wakeOne();
-                didCancelOrFinish = true;
-            }
-            else {
-                _state.hopefullyTransition(
-                    State::Pausing, State::Paused, HERE
-                );
-                _stateWasChanged.wakeOne();
-                _stateWasChanged.wait(&_stateMutex);
+                if (state == State::Canceling) {
+                    //
+                    // Nothing but us can move the state out of Canceling
+                    //
+                    transition(State::Canceling, State::Canceled, HERE);
+                    didCancelOrFinish = true;
+                    break;
+                }
+
+                // A cancel can still race in ahead of us becoming Paused
+                //
+                hopefully(state == State::Pausing, HERE);
+                if (not compareAndSwapState(state, State::Paused))
+                    continue;
 
                 // Once we are paused, we just wait for a signal that we are to
                 // either be aborted or continue.  (Because we are paused
                 // there is no need to pass through a "Canceling" state while
                 // the event loop is still running.)
 
-                if (_state == State::Canceled)
+                leaveGroupRunning();
+                while ((state = this->state()) == State::Paused)
+                    sleepWhilePaused(State::Paused);
+                joinGroupRunning();
+
+                if (state == State::Canceled)
                     didCancelOrFinish = true;
                 else {
                   #ifndef Q_NO_EXCEPTIONS
@@ -338,39 +571,37 @@ bool ThinkerRunner::runThinker ()
                     hopefully(possiblyAbleToContinue, HERE);
                   #endif
 
-                    _state.hopefullyTransition(
-                        State::Resuming, State::Thinking,
-                        HERE
-                    );
-                    _stateWasChanged.wakeOne();
+                    _stopRequested.store(false, std::memory_order_relaxed);
+                    transition(State::Resuming, State::Thinking, HERE);
                 }
+                break;
             }
-
-            _stateMutex.unlock();
         }
 
         getThinker().beforeThreadDetach();
 
-        _helper.clear();  // we no longer need the helper object
+        getThinker()._stopRequested = nullptr;
+        getThinker()._groupEpoch = nullptr;
 
-        // For symmetry in constructor/destructor threading, we push the
-        // Thinker back to the thread it was initially defined on.  This time
-        // we can do it directly instead of asking that thread to do it for us.
-        //
-        getThinker().moveToThread(originalThinkerThread);
-        hopefully(getThinker().thread() == originalThinkerThread, HERE);
+        leaveGroupRunning();
 
-        _stateMutex.lock();
+        _helper.clear();  // we no longer need the helper object
     }
 
-    _state.hopefullyInSet(
-        State::Canceled, State::Canceling, State::Finished, HERE
-    );
+    // For symmetry in constructor/destructor threading, we push the Thinker
+    // back to the thread it was initially defined on (even if it was canceled
+    // before it ever ran, as it had no affinity at all while queued).
+    //
+    getThinker().moveToThread(_originalThread);
+    hopefully(getThinker().thread() == _originalThread, HERE);
 
-    bool wasCanceled = (_state != State::Finished);
-    _stateMutex.unlock();
+    state = this->state();
+    hopefully(
+        stateIn(state, State::Canceled, State::Canceling, State::Finished),
+        HERE
+    );
 
-    return wasCanceled;
+    return state != State::Finished;
 }
 
 
@@ -380,34 +611,38 @@ void ThinkerRunner::requestPauseCore(
     codeplace const & cp
 ){
     hopefullyCurrentThreadIsNotThinker(HERE);
-    getManager().processThreadPushes();
 
-    QMutexLocker lock (&_stateMutex);
-
-    if (_state == State::Queued) {
-        _state.hopefullyTransition(
-            State::Queued, State::QueuedButPaused, HERE
-        );
-        _stateWasChanged.wakeOne();
-    }
-    else if (_state == State::Finished) {
-        // do nothing
-    }
-    else if (isCanceledOkay and (
-        (_state == State::Canceling) or (_state == State::Canceled)
-    )){
-        // do nothing
-    }
-    else if (isPausedOkay and (
-        (_state == State::Pausing) or (_state == State::Paused)
-    )){
-        // do nothing
-    }
-    else {
-        _state.hopefullyTransition(State::Thinking, State::Pausing, cp);
-        _stateWasChanged.wakeOne();
-
-        emit breakEventLoop();
+    State state = this->state();
+    while (true) {
+        if (state == State::Queued) {
+            if (compareAndSwapState(state, State::QueuedButPaused))
+                return;
+        }
+        else if (state == State::Finished) {
+            return;
+        }
+        else if (isCanceledOkay and (
+            (state == State::Canceling) or (state == State::Canceled)
+        )){
+            return;
+        }
+        else if (isPausedOkay and (
+            (state == State::Pausing) or (state == State::Paused)
+        )){
+            return;
+        }
+        else {
+            // Failing the exchange here just means the thinker finished (or
+            // got canceled) under us, so we go around to check which
+            //
+            hopefully(state == State::Thinking, cp);
+            if (compareAndSwapState(state, State::Pausing)) {
+                _stopRequested.store(true, std::memory_order_release);
+                wakeGroup();
+                emit breakEventLoop();
+                return;
+            }
+        }
     }
 }
 
@@ -415,28 +650,23 @@ void ThinkerRunner::requestPauseCore(
 void ThinkerRunner::waitForPauseCore(bool isCanceledOkay)
 {
     hopefullyCurrentThreadIsNotThinker(HERE);
-    getManager().processThreadPushes();
 
-    QMutexLocker lock (&_stateMutex);
+    while (true) {
+        State state = this->state();
 
-    if (
-        (_state == State::Finished)
-        or (_state == State::Paused)
-        or (_state == State::QueuedButPaused)
-    ){
-        // do nothing
-    }
-    else if (isCanceledOkay and (_state == State::Canceled)) {
-        // do nothing
-    }
-    else if (isCanceledOkay and (_state == State::Canceling)) {
-        _stateWasChanged.wait(&_stateMutex);
-        _state.hopefullyEqualTo(State::Canceled, HERE);
-    }
-    else {
-        _state.hopefullyEqualTo(State::Pausing, HERE);
-        _stateWasChanged.wait(&_stateMutex);
-        _state.hopefullyInSet(State::Paused, State::Finished, HERE);
+        if (stateIn(
+            state, State::Finished, State::Paused, State::QueuedButPaused
+        )){
+            return;
+        }
+
+        if (isCanceledOkay and (state == State::Canceled))
+            return;
+
+        if (not isCanceledOkay or (state != State::Canceling))
+            hopefully(state == State::Pausing, HERE);
+
+        static_cast<void>(waitForStateChange(state));
     }
 }
 
@@ -446,33 +676,48 @@ void ThinkerRunner::requestCancelCore(
     codeplace const & cp
 ){
     hopefullyCurrentThreadIsNotThinker(cp);
-    getManager().processThreadPushes();
-
-    QMutexLocker lock (&_stateMutex);
 
-    if (
-        (_state == State::Queued)
-        or (_state == State::Finished)
-        or (_state == State::Paused)
-        or (_state == State::QueuedButPaused)
-    ){
-        _state.hopefullyAlter(State::Canceled, cp);
-        _stateWasChanged.wakeOne();
-    }
-    else if (isCanceledOkay and (
-        (_state == State::Canceled) or (_state == State::Canceling)
-    )){
-        // do nothing
-    }
-    else {
-        // No one can request a pause or stop besides the worker
-        // We should not multiply request stops and pauses...
-        // so if it's not initializing and not finished it must be thinking!
-
-        _state.hopefullyTransition(State::Thinking, State::Canceling, cp);
-        _stateWasChanged.wakeOne();
-
-        emit breakEventLoop();
+    State state = this->state();
+    while (true) {
+        if (stateIn(
+            state,
+            State::Queued, State::Finished,
+            State::Paused, State::QueuedButPaused
+        )){
+            if (compareAndSwapState(state, State::Canceled)) {
+                _stopRequested.store(true, std::memory_order_release);
+              #if THINKERQT_USE_FIBERS
+                unparkFiberIfNecessary();  // it has to be resumed to unwind
+              #endif
+                return;
+            }
+        }
+        else if (isCanceledOkay and (
+            (state == State::Canceled) or (state == State::Canceling)
+        )){
+            return;
+        }
+        else if (state == State::Resuming) {
+            //
+            // Let the thinker get back to Thinking so it can see the request
+            //
+            static_cast<void>(waitForStateChange(state));
+            state = this->state();
+        }
+        else {
+            // No one can request a pause or stop besides the worker
+            // We should not multiply request stops and pauses...
+            // so if it's not initializing and not finished it must be thinking
+            // (or on its way to pausing, which canceling takes precedence over)
+
+            hopefully(stateIn(state, State::Thinking, State::Pausing), cp);
+            if (compareAndSwapState(state, State::Canceling)) {
+                _stopRequested.store(true, std::memory_order_release);
+                wakeGroup();
+                emit breakEventLoop();
+                return;
+            }
+        }
     }
 }
 
@@ -482,51 +727,46 @@ void ThinkerRunner::requestResumeCore(
     codeplace const & cp
 ){
     hopefullyCurrentThreadIsNotThinker(cp);
-    getManager().processThreadPushes();
 
     waitForPauseCore(isCanceledOkay);
 
-    QMutexLocker lock (&_stateMutex);
-
-    if (_state == State::QueuedButPaused) {
-        _state.hopefullyAlter(State::Queued, HERE);
-        _stateWasChanged.wakeOne();
-    }
-    else if (_state == State::Finished) {
-        // do nothing
-    }
-    else if (isCanceledOkay and (_state == State::Canceled)) {
-        // do nothing
-    }
-    else {
-        _state.hopefullyTransition(State::Paused, State::Resuming, cp);
-        _stateWasChanged.wakeOne();  // only one should be waiting, max...
+    State state = this->state();
+    while (true) {
+        if (state == State::QueuedButPaused) {
+            if (compareAndSwapState(state, State::Queued))
+                break;
+        }
+        else if (state == State::Finished) {
+            return;
+        }
+        else if (isCanceledOkay and (state == State::Canceled)) {
+            return;
+        }
+        else {
+            hopefully(state == State::Paused, cp);
+            if (compareAndSwapState(state, State::Resuming))
+                break;
+        }
     }
+
+  #if THINKERQT_USE_FIBERS
+    unparkFiberIfNecessary();
+  #endif
 }
 
 
 void ThinkerRunner::waitForResume(codeplace const & cp)
 {
     hopefullyCurrentThreadIsNotThinker(cp);
-    getManager().processThreadPushes();
 
-    QMutexLocker lock (&_stateMutex);
+    State state = this->state();
 
-    if (
-        (_state == State::Thinking)
-        or (_state == State::Finished)
-        or (_state == State::Queued)
-    ){
-        // do nothing
-    }
-    else {
-        _state.hopefullyEqualTo(State::Resuming, HERE);
-        _stateWasChanged.wait(&_stateMutex);
-        _state.hopefullyInSet(
-            State::Resuming, State::Thinking, State::Finished,
-            HERE
-        );
-    }
+    if (stateIn(state, State::Thinking, State::Finished, State::Queued))
+        return;
+
+    hopefully(state == State::Resuming, HERE);
+    while ((state = this->state()) == State::Resuming)
+        static_cast<void>(waitForStateChange(state));
 }
 
 
@@ -534,32 +774,106 @@ void ThinkerRunner::waitForFinished(codeplace const & cp)
 {
     hopefullyCurrentThreadIsNotThinker(cp);
 
+    // Caller should know if they paused the thinker, and resume it before
+    // calling this routine!  A thinker that is Canceling is waited on too,
+    // as it's still running until it notices the request.
+    //
+    State state;
+    while (stateIn(
+        state = this->state(),
+        State::Queued, State::Thinking, State::Resuming, State::Canceling
+    )){
+        static_cast<void>(waitForStateChange(state));
+    }
+
+    hopefully(stateIn(state, State::Canceled, State::Finished), HERE);
+}
+
+
+void ThinkerRunner::setPriority(int priority, codeplace const & cp)
+{
+    hopefullyCurrentThreadIsNotThinker(cp);
+
     QMutexLocker lock (&_stateMutex);
 
-    if ((_state == State::Queued) or (_state == State::ThreadPush)) {
-        lock.unlock();
-        getManager().processThreadPushesUntil(this);
-        lock.relock();
-    }
+    if (_priority == priority)
+        return;
 
-    // Caller should know if they paused the thinker, and resume it before
-    // calling this routine!
+    _priority = priority;
+
+    // A QueuedButPaused runner is reordered too, so it is in the right place
+    // in line if it gets resumed before a thread picks it up
     //
-    if (_state == State::Thinking)
-        _stateWasChanged.wait(&_stateMutex);
+    if (_proxy)
+        static_cast<void>(getManager().requeueRunner(_proxy, priority));
+}
+
 
-    _state.hopefullyInSet(State::Canceled, State::Finished, HERE);
+int ThinkerRunner::priority() const
+{
+    QMutexLocker lock (&_stateMutex);
+
+    return _priority;
 }
 
 
-bool ThinkerRunner::isFinished() const
+bool ThinkerRunner::addCanceledCallback(std::function<void()> callback)
 {
-    hopefullyCurrentThreadIsNotThinker(HERE);
+    QMutexLocker lock (&_stateMutex);
+
+    if (_canceledCallbacksTaken)
+        return false;
+
+    _canceledCallbacks.append(callback);
+    return true;
+}
+
+
+QList<std::function<void()>> ThinkerRunner::takeCanceledCallbacks()
+{
+    QMutexLocker lock (&_stateMutex);
+
+    hopefully(not _canceledCallbacksTaken, HERE);
+    _canceledCallbacksTaken = true;
+
+    QList<std::function<void()>> result;
+    result.swap(_canceledCallbacks);
+    return result;
+}
+
+
+bool ThinkerRunner::addEndedCallback(std::function<void()> callback)
+{
+    QMutexLocker lock (&_stateMutex);
+
+    if (_endedCallbacksTaken)
+        return false;
+
+    _endedCallbacks.append(callback);
+    return true;
+}
 
+
+QList<std::function<void()>> ThinkerRunner::takeEndedCallbacks()
+{
     QMutexLocker lock (&_stateMutex);
 
-    switch (_state) {
+    hopefully(not _endedCallbacksTaken, HERE);
+    _endedCallbacksTaken = true;
+
+    QList<std::function<void()>> result;
+    result.swap(_endedCallbacks);
+    return result;
+}
+
+
+bool ThinkerRunner::isFinished() const
+{
+    hopefullyCurrentThreadIsNotThinker(HERE);
+
+    switch (state()) {
       case State::Queued:
+      case State::QueuedButPaused:
       case State::Thinking:
       case State::Pausing:
       case State::Paused:
@@ -569,6 +883,7 @@ bool ThinkerRunner::isFinished() const
       case State::Finished:
         return true;
 
+      case State::Canceling:
       case State::Canceled:
         return true;  // actually "indeterminate" (may finish while canceling)
 
@@ -584,10 +899,7 @@ bool ThinkerRunner::isCanceled() const
 {
     hopefullyCurrentThreadIsNotThinker(HERE);
 
-    QMutexLocker lock (&_stateMutex);
-
-    return (_state == State::Canceled)
-        or (_state == State::Canceling);
+    return stateIn(state(), State::Canceled, State::Canceling);
 }
 
 
@@ -595,39 +907,66 @@ bool ThinkerRunner::isPaused() const
 {
     hopefullyCurrentThreadIsNotThinker(HERE);
 
-    QMutexLocker lock (&_stateMutex);
-
-    return (_state == State::Paused)
-        or (_state == State::Pausing)
-        or (_state == State::QueuedButPaused);
+    return stateIn(
+        state(), State::Paused, State::Pausing, State::QueuedButPaused
+    );
 }
 
 
-bool ThinkerRunner::wasPauseRequested(unsigned long time) const
+bool ThinkerRunner::wasPauseRequested(unsigned long time)
 {
     hopefullyCurrentThreadIsRun(HERE);
 
-    QMutexLocker lock (&_stateMutex);
+    // A group pause is answered right here, and isn't a pause as far as the
+    // thinker can tell (so it doesn't need to be resumable)
+    //
+    sleepWhileGroupPaused();
+
+    State state = this->state();
 
-    if ((_state == State::Pausing) or (_state == State::Canceling))
+  #if THINKERQT_USE_FIBERS
+    if ((state == State::Pausing) and isOnFiber()) {
+        //
+        // No need to unwind start() and rely on the thinker implementing
+        // resume().  We just suspend right here, with the thinker's stack
+        // intact, and our caller never knows it was paused...unless it is
+        // canceled while paused, in which case it's told to stop.
+        //
+        if (compareAndSwapState(state, State::Paused)) {
+            leaveGroupRunning();
+            while ((state = this->state()) == State::Paused)
+                sleepWhilePaused(State::Paused);
+            joinGroupRunning();
+
+            if (state == State::Canceled)
+                return true;
+
+            _stopRequested.store(false, std::memory_order_relaxed);
+            transition(State::Resuming, State::Thinking, HERE);
+            state = State::Thinking;
+        }
+    }
+  #endif
+
+    if (stateIn(
+        state,
+        State::Pausing,
+        State::Canceling,
+        State::Canceled  // fiber canceled while paused
+    )){
         return true;
+    }
 
-    _state.hopefullyEqualTo(State::Thinking, HERE);
+    hopefully(state == State::Thinking, HERE);
     if (time == 0)
         return false;
 
-    bool didStateChange = _stateWasChanged.wait(&_stateMutex, time);
-    if (didStateChange)
-        _state.hopefullyInSet(State::Pausing, State::Canceling, HERE);
-    else
-        _state.hopefullyEqualTo(State::Thinking, HERE);
-
-    return didStateChange;
+    return waitForStateChange(State::Thinking, time);
 }
 
 
 #ifndef Q_NO_EXCEPTIONS
-    void ThinkerRunner::pollForStopException(unsigned long time) const
+    void ThinkerRunner::pollForStopException(unsigned long time)
     {
         if (wasPauseRequested(time))
             throw ThinkerRunner::StopException ();
@@ -640,9 +979,15 @@ ThinkerRunner::~ThinkerRunner () {
     // The thread this is deleted on may be either the thread pool thread
     // or the manager thread... it's controlled by a QSharedPointer
 
-    _state.hopefullyInSet(
-        State::Canceled, State::Canceling, State::Finished, HERE
+    hopefully(
+        stateIn(state(), State::Canceled, State::Canceling, State::Finished),
+        HERE
     );
+    hopefully(_waiters.load() == 0, HERE);
+
+  #if THINKERQT_USE_FIBERS
+    hopefully(not _fiberParked.load(), HERE);
+  #endif
 }
 
 
@@ -654,7 +999,12 @@ ThinkerRunner::~ThinkerRunner () {
 ThinkerRunnerProxy::ThinkerRunnerProxy(shared_ptr<ThinkerRunner> runner) :
     _runner (runner)
 {
-    getManager().addToThinkerMap(_runner);
+    // A runner on a fiber may get several proxies over its lifetime, one
+    // each time it is resumed after a pause.  So the manager puts it in the
+    // thinker map, not us.
+    //
+    QMutexLocker lock (&_runner->_stateMutex);
+    _runner->_proxy = this;
 }
 
 
@@ -666,10 +1016,54 @@ ThinkerManager & ThinkerRunnerProxy::getManager()
 
 void ThinkerRunnerProxy::run()
 {
-    getManager().addToThreadMap(_runner, *QThread::currentThread());
+    // Each pool thread is named once, the first time it picks up a thinker.
+    // The pool has only just started it then, so nothing else has had any
+    // reason to read its name yet.  (Neither QThreadPool nor the executor
+    // interface has a hook for when a thread is started.)
+    //
+    static thread_local bool threadWasNamed = false;
+
+    QThread * thread = QThread::currentThread();
+    if (not threadWasNamed) {
+        thread->setObjectName(getManager().threadName());
+        threadWasNamed = true;
+    }
+
+    getManager().addToThreadMap(_runner, *thread);
+
+    bool wasCanceled;
+
+  #if THINKERQT_USE_FIBERS
+    if (_runner->_fiberStackSize != 0) {
+        if (not _runner->_fiber) {
+            ThinkerRunner * runner = _runner.get();
+            _runner->_fiber.reset(new ThinkerFiber (
+                [runner]() {
+                    runner->_fiberWasCanceled = runner->runThinker();
+                },
+                _runner->_fiberStackSize
+            ));
+        }
+
+        _runner->_fiber->resume();
+
+        if (not _runner->_fiber->isFinished()) {
+            //
+            // The thinker is paused, and its stack is safe in the fiber.  So
+            // this thread can go back to the pool to run something else.
+            //
+            getManager().removeFromThreadMap(_runner, *thread);
+            _runner->fiberSuspended();
+            return;
+        }
+
+        wasCanceled = _runner->_fiberWasCanceled;
+    }
+    else
+  #endif
+        wasCanceled = _runner->runThinker();
 
-    bool wasCanceled = _runner->runThinker();
-    getManager().removeFromThreadMap(_runner, *QThread::currentThread());
+    getManager().removeFromThreadMap(_runner, *thread);
 
     getManager().removeFromThinkerMap(_runner, wasCanceled);
 
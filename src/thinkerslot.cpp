@@ -0,0 +1,175 @@
+//
+// thinkerslot.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include <QThread>
+
+#include "thinkerqt/thinkerslot.h"
+
+
+#ifdef THINKERQT_EXPLICIT_MANAGER
+    ThinkerSlotBase::ThinkerSlotBase (ThinkerManager & mgr, QObject * parent) :
+        QObject (parent),
+        _mgr (mgr),
+        _current (),
+        _serving (),
+        _watcher (),
+        _launcher (),
+        _launchQueued (false)
+    {
+        connect(
+            &_watcher, &ThinkerPresentWatcherBase::written,
+            this, &ThinkerSlotBase::currentWritten
+        );
+        connect(
+            &_watcher, &ThinkerPresentWatcherBase::finished,
+            this, &ThinkerSlotBase::currentFinished
+        );
+    }
+#else
+    ThinkerSlotBase::ThinkerSlotBase (QObject * parent) :
+        QObject (parent),
+        _mgr (ThinkerManager::getGlobalManager()),
+        _current (),
+        _serving (),
+        _watcher (),
+        _launcher (),
+        _launchQueued (false)
+    {
+        connect(
+            &_watcher, &ThinkerPresentWatcherBase::written,
+            this, &ThinkerSlotBase::currentWritten
+        );
+        connect(
+            &_watcher, &ThinkerPresentWatcherBase::finished,
+            this, &ThinkerSlotBase::currentFinished
+        );
+    }
+#endif
+
+
+bool ThinkerSlotBase::isEmpty() const
+{
+    return _current == ThinkerPresentBase ();
+}
+
+
+bool ThinkerSlotBase::isFinished() const
+{
+    if (isEmpty())
+        return false;
+
+    return _current.isFinished();
+}
+
+
+void ThinkerSlotBase::runBase(std::function<ThinkerPresentBase()> launcher)
+{
+    hopefully(QThread::currentThread() == thread(), HERE);
+
+    // Whatever is running now is obsolete, but we keep its Present (and so
+    // its snapshots) until the replacement has something to show
+    //
+    if (not isEmpty() and not _current.isFinished())
+        _current.cancelAsync(nullptr);
+
+    // If a launch is already queued, it will just pick up this newer request
+    //
+    _launcher = launcher;
+    if (_launchQueued)
+        return;
+
+    _launchQueued = true;
+    QMetaObject::invokeMethod(
+        this,
+        [this]() { launch(); },
+        Qt::QueuedConnection
+    );
+}
+
+
+void ThinkerSlotBase::launch()
+{
+    _launchQueued = false;
+
+    if (not _launcher)
+        return;  // canceled before it could start
+
+    std::function<ThinkerPresentBase()> launcher;
+    launcher.swap(_launcher);
+
+    _current = launcher();
+    _watcher.setPresentBase(_current);
+
+    if (_serving == ThinkerPresentBase ())
+        _serving = _current;
+}
+
+
+void ThinkerSlotBase::serveCurrent()
+{
+    if (_serving != _current)
+        _serving = _current;  // the old thinker can go now
+}
+
+
+void ThinkerSlotBase::currentWritten()
+{
+    serveCurrent();
+    emit written();
+}
+
+
+void ThinkerSlotBase::currentFinished()
+{
+    // A done() from a thinker the watcher was switched away from may still
+    // have been in the event queue
+    //
+    if (not _current.isFinished() or _current.isCanceled())
+        return;
+
+    serveCurrent();
+    emit finished();
+}
+
+
+void ThinkerSlotBase::cancel()
+{
+    hopefully(QThread::currentThread() == thread(), HERE);
+
+    _launcher = nullptr;
+
+    if (not isEmpty())
+        _current.cancelAsync(nullptr);
+}
+
+
+SnapshotBase * ThinkerSlotBase::createSnapshotBase() const
+{
+    hopefully(_serving != ThinkerPresentBase (), HERE);
+
+    return _serving.createSnapshotBase();
+}
+
+
+ThinkerSlotBase::~ThinkerSlotBase ()
+{
+    cancel();
+}
@@ -0,0 +1,325 @@
+//
+// workstealingexecutor.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include <QMutexLocker>
+#include <QElapsedTimer>
+
+#include "thinkerqt/workstealingexecutor.h"
+
+
+thread_local WorkStealingExecutor::Worker *
+    WorkStealingExecutor::_currentWorker = nullptr;
+
+
+//
+// WorkStealingExecutor::Worker
+//
+
+WorkStealingExecutor::Worker::Worker (
+    WorkStealingExecutor & executor,
+    int index
+) :
+    QThread (),
+    _executor (executor),
+    _index (index),
+    _deque ()
+{
+}
+
+
+void WorkStealingExecutor::Worker::run()
+{
+    _currentWorker = this;
+
+    forever {
+        QRunnable * runnable = _executor.findWork(*this);
+        if (runnable) {
+            _executor.runAndRelease(runnable);
+            continue;
+        }
+
+        QMutexLocker lock (&_executor._mutex);
+
+        if (_executor._stopping.load())
+            break;
+
+        // Announce that we're going to sleep *before* the final check for
+        // work.  start() pushes and then looks for sleepers, so between the
+        // two fences at least one of us will see what the other did.  (The
+        // injection queue is covered by the mutex, but local deque pushes
+        // are not.)
+        //
+        _executor._sleepers.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        bool anyWork = (_executor._injectedCount.load() > 0);
+        QList<Worker *> const & workers = _executor._workers;
+        for (Worker * worker : workers) {
+            if (not worker->_deque.isEmpty())
+                anyWork = true;
+        }
+
+        if (not anyWork)
+            _executor._workAvailable.wait(&_executor._mutex);
+
+        _executor._sleepers.fetch_sub(1);
+    }
+
+    _currentWorker = nullptr;
+}
+
+
+WorkStealingExecutor::Worker::~Worker ()
+{
+}
+
+
+
+//
+// WorkStealingExecutor
+//
+
+WorkStealingExecutor::WorkStealingExecutor (int maxThreadCount) :
+    ThinkerExecutor (),
+    _maxThreadCount (
+        maxThreadCount > 0 ? maxThreadCount : QThread::idealThreadCount()
+    ),
+    _stackSize (0),
+    _mutex (),
+    _workers (),
+    _injected (),
+    _injectedCount (0),
+    _workAvailable (),
+    _sleepers (0),
+    _stopping (false),
+    _outstanding (0),
+    _doneMutex (),
+    _allDone ()
+{
+}
+
+
+void WorkStealingExecutor::startWorkersIfNecessary()
+{
+    // caller holds _mutex
+
+    if (not _workers.isEmpty())
+        return;
+
+    // All the workers are in the list before any of them start, so they
+    // can walk it for stealing without taking the lock
+    //
+    for (int index = 0; index < _maxThreadCount; ++index) {
+        Worker * worker = new Worker (*this, index);
+        if (_stackSize != 0)
+            worker->setStackSize(_stackSize);
+        _workers.append(worker);
+    }
+
+    for (Worker * worker : _workers)
+        worker->start();
+}
+
+
+void WorkStealingExecutor::start(QRunnable * runnable, int priority)
+{
+    Q_UNUSED(priority)
+
+    hopefully(runnable != nullptr, HERE);
+    hopefully(not _stopping.load(), HERE);
+
+    _outstanding.fetch_add(1);
+
+    Worker * current = _currentWorker;
+    if (current and (&current->_executor == this)) {
+        //
+        // Spawned from inside one of our own workers; no locks needed.  The
+        // owner will get to it itself if no one steals it first, so a missed
+        // wakeup here costs parallelism but never progress.
+        //
+        current->_deque.push(runnable);
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_sleepers.load() > 0) {
+            QMutexLocker lock (&_mutex);
+            _workAvailable.wakeOne();
+        }
+        return;
+    }
+
+    QMutexLocker lock (&_mutex);
+
+    startWorkersIfNecessary();
+
+    _injected.append(runnable);
+    _injectedCount.fetch_add(1);
+
+    if (_sleepers.load() > 0)
+        _workAvailable.wakeOne();
+}
+
+
+QRunnable * WorkStealingExecutor::findWork(Worker & worker)
+{
+    QRunnable * runnable = nullptr;
+
+    if (worker._deque.pop(runnable))
+        return runnable;
+
+    // Try the siblings, starting with the next one over so that not every
+    // idle worker hammers on worker 0
+    //
+    QList<Worker *> const & workers = _workers;
+    int count = workers.size();
+    for (int offset = 1; offset < count; ++offset) {
+        Worker * victim = workers.at((worker._index + offset) % count);
+        if (victim->_deque.steal(runnable))
+            return runnable;
+    }
+
+    if (_injectedCount.load() > 0) {
+        QMutexLocker lock (&_mutex);
+        if (not _injected.isEmpty()) {
+            _injectedCount.fetch_sub(1);
+            return _injected.takeFirst();
+        }
+    }
+
+    return nullptr;
+}
+
+
+void WorkStealingExecutor::runAndRelease(QRunnable * runnable)
+{
+    // Same as QThreadPool: check autoDelete() before running, because the
+    // runnable is allowed to change it during run()
+    //
+    bool autoDelete = runnable->autoDelete();
+
+    runnable->run();
+
+    if (autoDelete)
+        delete runnable;
+
+    if (_outstanding.fetch_sub(1) == 1) {
+        QMutexLocker lock (&_doneMutex);
+        _allDone.wakeAll();
+    }
+}
+
+
+bool WorkStealingExecutor::tryTake(QRunnable * runnable)
+{
+    // Can't pull things out of the middle of a Chase-Lev deque
+    //
+    Q_UNUSED(runnable)
+    return false;
+}
+
+
+bool WorkStealingExecutor::waitForDone(int milliseconds)
+{
+    hopefully(_currentWorker == nullptr, HERE);  // would wait on ourself
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QMutexLocker lock (&_doneMutex);
+
+    while (_outstanding.load() > 0) {
+        if (milliseconds < 0)
+            _allDone.wait(&_doneMutex);
+        else {
+            qint64 remaining = milliseconds - timer.elapsed();
+            if (remaining <= 0)
+                return false;
+            _allDone.wait(&_doneMutex, static_cast<unsigned long>(remaining));
+        }
+    }
+    return true;
+}
+
+
+void WorkStealingExecutor::setMaxThreadCount(int maxThreadCount)
+{
+    QMutexLocker lock (&_mutex);
+
+    hopefully(_workers.isEmpty(), HERE);  // see notes in header
+    _maxThreadCount =
+        maxThreadCount > 0 ? maxThreadCount : QThread::idealThreadCount();
+}
+
+
+int WorkStealingExecutor::maxThreadCount() const
+{
+    return _maxThreadCount;
+}
+
+
+void WorkStealingExecutor::setStackSize(uint stackSize)
+{
+    QMutexLocker lock (&_mutex);
+
+    hopefully(_workers.isEmpty(), HERE);  // see notes in header
+    _stackSize = stackSize;
+}
+
+
+uint WorkStealingExecutor::stackSize() const
+{
+    return _stackSize;
+}
+
+
+void WorkStealingExecutor::setExpiryTimeout(int milliseconds)
+{
+    // Workers stay parked on a wait condition while idle, and are only shut
+    // down with the executor
+    //
+    Q_UNUSED(milliseconds)
+}
+
+
+int WorkStealingExecutor::expiryTimeout() const
+{
+    return -1;  // QThreadPool's convention for "never expires"
+}
+
+
+WorkStealingExecutor::~WorkStealingExecutor ()
+{
+    waitForDone();
+
+    {
+        QMutexLocker lock (&_mutex);
+        _stopping.store(true);
+        _workAvailable.wakeAll();
+    }
+
+    // A worker that is still running may be stealing from any of the
+    // others, so none of them can be freed until all of them have stopped
+    //
+    for (Worker * worker : _workers)
+        worker->wait();
+
+    for (Worker * worker : _workers)
+        delete worker;
+}